@@ -7,59 +7,76 @@
  * Author: Richard Gale
  */
 
+/* For O_DIRECT, sync_file_range() and copy_file_range(). */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+/* Keeping the header from including this file again. */
+#define MYCUTILS_C
+
 #include "mycutils.h"
 
-/******************************** Maths **************************************/
+#include <linux/fs.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
 
 /**
- * This function maps value x to a value within a desired range.
+ * This is set by cpu_init() if the SSE2 kernels of the CSV, JSON, string
+ * and terminal code may be used. They check it, rather than only whether
+ * they were built with SSE2, so that MYCUTILS_CPU=scalar reaches their
+ * plain versions too. Each of them calls cpu_level() before reading it.
  */
-double map(double x, double in_min,  double in_max, 
-                     double out_min, double out_max)
-{
-    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
-}
+static bool cpu_sse2;
 
-/********************************* Time **************************************/
+/******************************** Probes *************************************/
 
 /**
- * This function returns true if a number of nano-seconds equal to or greater
- * than wait_time has elapsed since start.
+ * These macros place USDT (user-level statically defined tracing) probes on
+ * the library's hot paths. When <sys/sdt.h> is available each probe compiles
+ * to a single nop that tools such as bpftrace or perf can attach to at run
+ * time, so a disabled probe costs nothing. Durations are found by pairing a
+ * probe's *_entry and *_return events. Whether probes are available is
+ * worked out in mycutils.h, and defining MYCUTILS_NO_PROBES compiles them out
+ * entirely.
  */
-bool check_timer(struct timespec start, uint64_t wait_time)
-{
-    const bool HAS_ELAPSED = true;      /* Value if time has elapsed. */
-    const bool NOT_ELAPSED = false;     /* Value if time has not elapsed. */
-    struct timespec current;            /* The current time. */
-    struct timespec elapsed;            /* The time elapsed since start. */
-
-    /* Obtaining the current time. */
-    clock_gettime(CLOCK_REALTIME, &current);
+#ifdef MYCUTILS_HAVE_PROBES
+#define PROBE1(name, a)         DTRACE_PROBE1(mycutils, name, a)
+#define PROBE2(name, a, b)      DTRACE_PROBE2(mycutils, name, a, b)
+#define PROBE3(name, a, b, c)   DTRACE_PROBE3(mycutils, name, a, b, c)
+#else
+#define PROBE1(name, a)         do { } while (0)
+#define PROBE2(name, a, b)      do { } while (0)
+#define PROBE3(name, a, b, c)   do { } while (0)
+#endif
 
-    /* Calculating the elapsed time. */
-    elapsed.tv_sec = current.tv_sec - start.tv_sec;
-    elapsed.tv_nsec = current.tv_nsec - start.tv_nsec;
-
-    /* Checking whether the time hasn't elapsed. */
-    if ((elapsed.tv_sec * NANOS_PER_SEC) + elapsed.tv_nsec < wait_time)
-        return NOT_ELAPSED;
-
-    /* The time has elapsed. */
-    return HAS_ELAPSED;
-}
+/********************************* Time **************************************/
 
 /**
  * This function obtains the current time and stores it in the timespec
  * that was provided to it.
  */
-void start_timer(struct timespec* ts)
+MYCUTILS_API void start_timer(struct timespec* ts)
 {
     char* tstamp;
 
     /* Obtaining the current time.*/
     if ((clock_gettime(CLOCK_REALTIME, ts)) != -1)
+    {
+        PROBE2(start_timer, (int64_t) ts->tv_sec, (int64_t) ts->tv_nsec);
+        flight_record(FLIGHT_START_TIMER, -1, 0);
         return;
-        
+    }
+
+    /* Recording the failure and dumping the recent events. */
+    flight_record(FLIGHT_START_TIMER, -1, -errno);
+    flight_dump();
+
     /* An error occured so we are printing an error message. */
     fprintf(stderr, 
             "[ %s ] ERROR: in function start_timer(): %s\n",
@@ -78,7 +95,7 @@ void start_timer(struct timespec* ts)
  * For reasons detailed in a comment within this function, you must
  * free() the string that this function returns.
  */
-char* timestamp()
+MYCUTILS_API char* timestamp()
 {
     time_t current_time;    /* The current time. */
     char* stamp;            /* The time stamp. */
@@ -126,11 +143,35 @@ char* timestamp()
 
 /******************************** In/Out *************************************/
 
+/**
+ * This function prints an error that occurred in the function named func
+ * while working on the file named fname. It dumps the flight recorder then
+ * exits the program.
+ */
+static void fail(char* func, char* fname)
+{
+    char* tstamp;   /* A time stamp. */
+
+    /* Dumping the recent events. */
+    flight_dump();
+
+    /* Printing the error message. */
+    fprintf(stderr,
+            "[ %s ] ERROR: In function %s(): %s: %s\n",
+            (tstamp = timestamp()), func, fname, strerror(errno));
+
+    /* De-allocating memory. */
+    free(tstamp);
+
+    /* Exiting the program. */
+    exit(EXIT_FAILURE);
+}
+
 /**
  * This function prints a prompt to the user, then assigns a string that is
  * input by the user to the string pointer provided to it.
  */
-void scans(char** buf, char* prompt)
+MYCUTILS_API void scans(char** buf, char* prompt)
 {
     char* buf_cpy;  /* A copy of the buffer. */
     char userin;    /* The user input. */
@@ -192,8 +233,7 @@ void scans(char** buf, char* prompt)
  * This function returns a char that was input by the user. It doesn't wait
  * for the user to press enter. (Not my code)
  */
-char scanc_nowait() {
-        char buf = 0;
+MYCUTILS_API char scanc_nowait() { char buf = 0;
         struct termios old = {0};
         if (tcgetattr(0, &old) < 0)
                 perror("tcsetattr()");
@@ -216,13 +256,26 @@ char scanc_nowait() {
  * This function closes the file stream provided tp it. If there is an error,
  * it is printed on stderr and the program will exit.
  */
-void closefs(FILE* fs)
+MYCUTILS_API void closefs(FILE* fs)
 {
     char* tstamp;   /* A time stamp. */
+    int ret;        /* The return value of fclose(). */
+    int fd;         /* The file stream's descriptor. */
 
     /* Closing the file stream. */
-    if (fclose(fs) == 0)
+    PROBE1(closefs_entry, fs);
+    fd = fileno(fs);
+    ret = fclose(fs);
+    PROBE2(closefs_return, fs, ret);
+    if (ret == 0)
+    {
+        flight_record(FLIGHT_CLOSEFS, fd, 0);
         return;
+    }
+
+    /* Recording the failure and dumping the recent events. */
+    flight_record(FLIGHT_CLOSEFS, fd, -errno);
+    flight_dump();
     
     /* An error occured so we are printing an error message. */
     fprintf(stderr,
@@ -243,14 +296,24 @@ void closefs(FILE* fs)
  * is exited. If the file is successfully opened, this function
  * will return a pointer to the file stream.
  */
-FILE* openfs(char* fname, char* mode)
+MYCUTILS_API FILE* openfs(char* fname, char* mode)
 {
     FILE* fs;       /* The pointer to the file stream. */
     char* tstamp;   /* A time stamp. */
 
     /* Opening the file. */
-    if ((fs = fopen(fname, mode)) != NULL)
+    PROBE2(openfs_entry, fname, mode);
+    fs = fopen(fname, mode);
+    PROBE2(openfs_return, fname, fs);
+    if (fs != NULL)
+    {
+        flight_record(FLIGHT_OPENFS, fileno(fs), 0);
         return fs;
+    }
+
+    /* Recording the failure and dumping the recent events. */
+    flight_record(FLIGHT_OPENFS, -1, -errno);
+    flight_dump();
 
     /* An error occured so we're printing an error message. */
     fprintf(stderr, 
@@ -270,7 +333,7 @@ FILE* openfs(char* fname, char* mode)
  * the buffer provided to it. It returns true on success or false if EOF is
  * reached. It will exit the program if an error occurs.
  */
-bool readfsc(FILE* fs, char* buf)
+MYCUTILS_API bool readfsc(FILE* fs, char* buf)
 {
     const bool SUCCESS = true;      /* Return value if success. */
     const bool END_OF_FILE = false; /* Return value if EOF. */
@@ -279,12 +342,19 @@ bool readfsc(FILE* fs, char* buf)
     /* Getting the next char from the file stream and checking if it was
      * successfully read. */
     if ((*buf = fgetc(fs)) != EOF) 
+    {
+        flight_record(FLIGHT_READFSC, fileno(fs), 1);
         return SUCCESS;
+    }
 
     /* Checking if EOF was reached. */
     if (!ferror(fs)) 
         return END_OF_FILE;
 
+    /* Recording the failure and dumping the recent events. */
+    flight_record(FLIGHT_READFSC, fileno(fs), -errno);
+    flight_dump();
+
     /* An error occurred so we're printing an error message. */
     fprintf(stderr,
             "[ %s ] ERROR: In function readfsc(): %s\n",
@@ -304,11 +374,12 @@ bool readfsc(FILE* fs, char* buf)
  * or false if EOF was reached. If an error occurs the program will exit.
  * Make sure to free() the buffer when you're finished with it.
  */
-bool readfsl(FILE* fs, char** buf)
+MYCUTILS_API bool readfsl(FILE* fs, char** buf)
 {
     const bool SUCCESS = true;      /* Return value if success. */
     const bool END_OF_FILE = false; /* Return value if EOF. */
     size_t n;                       /* Allocated size of the buffer. */
+    ssize_t len;                    /* The length of the line read. */
     char* tstamp;                   /* A time stamp. */
 
     /* Initialising how big the buffer is. */
@@ -316,17 +387,27 @@ bool readfsl(FILE* fs, char** buf)
     
     /* Reading the next line from the file stream and checking if it was
      * read successfully. */
-    if (getline(buf, &n, fs) != -1)
+    PROBE1(readfsl_entry, fs);
+    len = getline(buf, &n, fs);
+    PROBE2(readfsl_return, fs, len);
+    if (len != -1)
+    {
+        flight_record(FLIGHT_READFSL, fileno(fs), len);
         return SUCCESS;
+    }
 
     /* Checking if EOF was reached. */
     if (!ferror(fs))
         return END_OF_FILE;
+
+    /* Recording the failure and dumping the recent events. */
+    flight_record(FLIGHT_READFSL, fileno(fs), -errno);
+    flight_dump();
             
     /* An error occurred so we are printing an error message. */
     fprintf(stdout,
             "[ %s ] ERROR: In function readfsl: %s\n",
-            timestamp(), strerror(errno));
+            (tstamp = timestamp()), strerror(errno));
 
     /* De-allocating memory. */
     free(tstamp);
@@ -336,387 +417,6255 @@ bool readfsl(FILE* fs, char** buf)
 }
 
 /**
- * This function writes the char provided to it to the file stream provided to
- * it.
+ * This function writes the string provided to it to the file stream provided
+ * to it.
  */
-void writefsc(FILE* fs, char ch)
+MYCUTILS_API void writefss(FILE* fs, char* str)
 {
-    /* Writing the char to the file stream. */
-    fprintf(fs, "%c", ch); 
+    /* Writing the string to the file stream. */
+    writefsn(fs, str, strlen(str));
 }
 
 /**
- * This function writes the string provided to it to the file stream provided
- * to it.
+ * This function writes len chars of the string provided to it to the file
+ * stream provided to it.
  */
-void writefss(FILE* fs, char* str)
+MYCUTILS_API void writefsn(FILE* fs, const char* str, size_t len)
 {
-    int c;  /* Index of the current char in the string. */
-
     /* Writing the string to the file stream. */
-    for (c = 0; c < strlen(str); c++)
-        writefsc(fs, str[c]);
+    PROBE2(writefss_entry, fs, len);
+    fwrite(str, 1, len, fs);
+    PROBE2(writefss_return, fs, len);
+    flight_record(FLIGHT_WRITEFSS, fileno(fs), len);
 }
 
-/******************************** Strings ************************************/
+/**
+ * These hold the state shared by threads committing atomic writes. Each
+ * commit takes a ticket and adds its directory to the pending list. One
+ * thread at a time syncs every pending directory on behalf of the rest, so
+ * many concurrent commits cost only a few directory syncs.
+ */
+static pthread_mutex_t dirsync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dirsync_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t dirsync_ticket;     /* The last ticket handed out. */
+static uint64_t dirsync_done;       /* The last ticket that is durable. */
+static bool dirsync_running;        /* Whether a thread is syncing. */
+static char** dirsync_pending;      /* Directories waiting to be synced. */
+static size_t dirsync_npending;     /* The number of pending directories. */
+static size_t dirsync_cap;          /* The allocated size of the list. */
 
 /**
- * This function returns the number of bytes a string will need to be
- * allocated based on the variable argument list and a format string that are
- * provided to this function.
+ * This function returns the directory part of the file name provided to it.
+ * Make sure to free() the string it returns.
  */
-size_t vbytesfmt(va_list lp, char* fmt)
+static char* dir_of(char* fname)
 {
-    va_list lp_cpy; /* A Copy of the list of arguments. */
-    size_t bytes;   /* The number of bytes the string needs. */
+    char* slash;    /* The last slash in the file name. */
+    char* dir;      /* The directory name. */
 
-    /* Copying the argument list. */
-    va_copy(lp_cpy, lp);
+    /* Files without a directory are in the current directory. */
+    if ((slash = strrchr(fname, '/')) == NULL)
+    {
+        strfmt(&dir, ".");
+        return dir;
+    }
 
-    /* Getting the number of bytes the string will need. Adding an extra
-     * 1 char worth of bytes for the null character. */
-    bytes = vsnprintf(NULL, 0, fmt, lp_cpy) + sizeof(char);
+    /* Files directly beneath the root are in the root. */
+    if (slash == fname)
+    {
+        strfmt(&dir, "/");
+        return dir;
+    }
 
-    /* Assuring a clean finish to the copy. */
-    va_end(lp_cpy);
+    /* Copying everything before the last slash. */
+    strfmt(&dir, "%.*s", (int) (slash - fname), fname);
+    return dir;
+}
 
-    /* Returning the number of bytes the string will need. */
-    return bytes;
+/**
+ * This function syncs the directory provided to it.
+ */
+static void sync_dir(char* dir)
+{
+    int fd;     /* The directory's descriptor. */
+
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
+        fail("closefs_atomic", dir);
+    if (fsync(fd) == -1)
+        fail("closefs_atomic", dir);
+    close(fd);
 }
 
 /**
- * This function dynamically allocates only the needed amount of memory to a
- * string based on the argument list, then concatenates the argument list into 
- * the supplied format and stores it in the supplied string pointer.
+ * This function waits until the directory provided to it has been synced
+ * after the caller's rename. Whichever waiting thread finds no sync running
+ * syncs every pending directory for the whole batch.
  */
-void strfmt(char** sp, char *fmt, ...)
+static void sync_dir_batched(char* dir)
 {
-    va_list lp;     /* Pointer to the list of arguments. */
-    size_t bytes;   /* The number of bytes the string needs. */
+    uint64_t ticket;    /* This commit's ticket. */
+    uint64_t upto;      /* The last ticket covered by a batch. */
+    char** batch;       /* The directories in a batch. */
+    size_t nbatch;      /* The number of directories in a batch. */
+    size_t d;           /* Index of the current directory. */
 
-    /* Pointing to the first argument. */
-    va_start(lp, fmt);
+    pthread_mutex_lock(&dirsync_lock);
 
-    /* Getting the number of bytes the string will need to be allocated. */
-    bytes = vbytesfmt(lp, fmt);
+    /* Taking a ticket. */
+    ticket = ++dirsync_ticket;
 
-    /* Allocating memory to the string. */
-    *sp = (char*) malloc(bytes);
+    /* Adding the directory to the pending list unless it is there already. */
+    for (d = 0; d < dirsync_npending; d++)
+        if (strcmp(dirsync_pending[d], dir) == 0)
+            break;
+    if (d == dirsync_npending)
+    {
+        if (dirsync_npending == dirsync_cap)
+        {
+            dirsync_cap = dirsync_cap ? dirsync_cap * 2 : 8;
+            dirsync_pending = (char**) realloc(dirsync_pending, 
+                                               sizeof(char*) * dirsync_cap);
+        }
+        strfmt(&dirsync_pending[dirsync_npending++], "%s", dir);
+    }
 
-    /* Creating the string. */
-    vsprintf(*sp, fmt, lp);
+    /* Waiting until a batch containing our ticket is durable. */
+    while (dirsync_done < ticket)
+    {
+        /* Waiting for the running batch if there is one. */
+        if (dirsync_running)
+        {
+            pthread_cond_wait(&dirsync_cond, &dirsync_lock);
+            continue;
+        }
 
-    /* Assuring a clean finish to the argument list. */
-    va_end(lp);
+        /* Taking every pending directory as a new batch. */
+        dirsync_running = true;
+        upto = dirsync_ticket;
+        batch = dirsync_pending;
+        nbatch = dirsync_npending;
+        dirsync_pending = NULL;
+        dirsync_npending = 0;
+        dirsync_cap = 0;
+
+        /* Syncing the batch without holding the lock. */
+        pthread_mutex_unlock(&dirsync_lock);
+        for (d = 0; d < nbatch; d++)
+        {
+            sync_dir(batch[d]);
+            free(batch[d]);
+        }
+        free(batch);
+        pthread_mutex_lock(&dirsync_lock);
+
+        /* Waking up everyone in the batch. */
+        dirsync_done = upto;
+        dirsync_running = false;
+        pthread_cond_broadcast(&dirsync_cond);
+    }
+
+    pthread_mutex_unlock(&dirsync_lock);
 }
 
 /**
- * This function removes the char element from the string provided to it which
- * is at the element number/index provided to it.
+ * This function returns the permissions open() gives a new file, which are
+ * 0666 less the process's umask. The umask is read from /proc if it can be,
+ * since setting it to read it back would briefly change it for every other
+ * thread.
+ */
+static mode_t new_file_mode()
+{
+    char line[64];  /* A line of the process's status. */
+    unsigned mask;  /* The umask. */
+    FILE* fs;       /* The process's status. */
+    bool found;     /* Whether the umask was found. */
+
+    found = false;
+    if ((fs = fopen("/proc/self/status", "r")) != NULL)
+    {
+        while (!found && fgets(line, sizeof(line), fs) != NULL)
+            found = sscanf(line, "Umask: %o", &mask) == 1;
+        fclose(fs);
+    }
+    if (!found)
+    {
+        mask = umask(022);
+        umask(mask);
+    }
+    return 0666 & ~mask;
+}
+
+/**
+ * This function begins replacing the file that has a name that matches fname.
+ * It opens a temporary file in the same directory for writing. The file
+ * named fname is not touched until closefs_atomic() is called. If fname is a
+ * symbolic link, the file it points to is replaced and the link is kept.
+ * If there is an error it will be printed on stderr and the program is
+ * exited.
  */
-void sdelelem(char** sp, unsigned elem)
+MYCUTILS_API atomicfs* openfs_atomic(char* fname)
 {
-    char* to_elem;      /* Chars from start of string to element to delete. */
-    char* from_elem;    /* Chars from element to delete to end of string. */
-    unsigned c;         /* The current char in the string. */
+    atomicfs* afs;      /* The atomic write. */
+    struct stat st;     /* The status of the file being replaced. */
+    char* real;         /* The file a symbolic link points to. */
+    int fd;             /* The temporary file's descriptor. */
 
     /* Allocating memory. */
-    to_elem     = (char*) malloc(sizeof(char) * (elem + 1));
-    from_elem   = (char*) malloc(sizeof(char) * (strlen(*sp) - elem));
+    afs = (atomicfs*) malloc(sizeof(atomicfs));
 
-    /* Storing the two sections of the string. */
-    for (c = 0; c < strlen(*sp); c++)
+    /* Following symbolic links, so the rename replaces the file a link
+     * points to rather than the link itself. A file that doesn't exist yet
+     * is created under the name given. */
+    if ((real = realpath(fname, NULL)) != NULL)
     {
-        if (c < elem)
-            to_elem[c] = (*sp)[c];
-        if (c > elem)
-            from_elem[c] = (*sp)[c];
+        strfmt(&afs->fname, "%s", real);
+        free(real);
     }
-    to_elem[elem] = '\0';
-    from_elem[strlen(*sp) - elem - 1] = '\0';
+    else
+        strfmt(&afs->fname, "%s", fname);
+    strfmt(&afs->tmpname, "%s.XXXXXX", afs->fname);
 
-    /* Recreating the string. */
-    free(*sp);
-    strfmt(sp, "%s%s", to_elem, from_elem);
+    /* Creating the temporary file next to the one being replaced, so the
+     * rename stays on the same filesystem. */
+    if ((fd = mkstemp(afs->tmpname)) == -1)
+        fail("openfs_atomic", afs->tmpname);
 
-    /* Cleaning up. */
-    free(to_elem);
-    free(from_elem);
+    /* Keeping the permissions of the file being replaced, or giving a new
+     * file the ones open() would. */
+    if (fchmod(fd, stat(afs->fname, &st) == 0 ? 
+                   st.st_mode & 07777 : new_file_mode()) == -1)
+    {
+        unlink(afs->tmpname);
+        fail("openfs_atomic", afs->tmpname);
+    }
+
+    /* Opening a stream on the temporary file. */
+    if ((afs->fs = fdopen(fd, "w")) == NULL)
+    {
+        unlink(afs->tmpname);
+        fail("openfs_atomic", afs->tmpname);
+    }
+
+    return afs;
 }
 
 /**
- * This function removes all cases of the provided char from the string at the
- * provided pointer.
+ * This function commits an atomic write. It flushes and syncs the temporary
+ * file, renames it over the file being replaced, then syncs the directory so
+ * the rename is durable. Threads committing at the same time share their
+ * directory syncs. If there is an error the temporary file is removed, the
+ * error is printed on stderr and the program is exited.
  */
-void sdelchar(char** sp, char remove)
+MYCUTILS_API void closefs_atomic(atomicfs* afs)
 {
-    unsigned c;     /* Index of current char in the string. */
+    char* dir;  /* The directory containing the file. */
 
-    /* Overwriting the unwanted characters. */
-	for (c = 0; c < strlen(*sp); c++)
-	{
-        if ((*sp)[c] == remove)
-        {
-            sdelelem(sp, c);
+    /* Making the temporary file's contents durable. */
+    if (fflush(afs->fs) != 0 || fsync(fileno(afs->fs)) == -1)
+    {
+        unlink(afs->tmpname);
+        fail("closefs_atomic", afs->tmpname);
+    }
+    closefs(afs->fs);
 
-            /* Decrementing the index so we will check the replacement 
-             * character. */
-            c--;
-        }
+    /* Replacing the file, and not leaving the temporary one behind if that
+     * can't be done. */
+    if (rename(afs->tmpname, afs->fname) == -1)
+    {
+        unlink(afs->tmpname);
+        fail("closefs_atomic", afs->fname);
     }
-}
 
-/******************************* Terminal ************************************/
+    /* Making the rename durable. */
+    dir = dir_of(afs->fname);
+    sync_dir_batched(dir);
 
-/**
- * This function clears the entire terminal and positions the cursor at home.
- */
-void clear()
-{
-    /* Clearing the terminal and putting the cursor at home. */
-    system("tput clear");
+    /* Cleaning up. */
+    free(dir);
+    free(afs->tmpname);
+    free(afs->fname);
+    free(afs);
 }
 
 /**
- * This function clears the current line the terminal cursor is on from
- * the position of the cursor to the line's beginning.
+ * This is the initial size of a follower's read buffer.
  */
-void clearb()
-{
-    /* Clearing from the cursor to the beginning of the line. */
-    system("tput el1");
-}
+#define FOLLOW_BUF_SIZE 65536
 
 /**
- * This function clears the current line the terminal cursor is on from
- * the position of the cursor to the line's end.
+ * This is a follower of a growing file. Only the bytes appended since the
+ * last read are fetched, with pread() into a buffer that is reused.
  */
-void clearf()
-{
-    /* Clearing from the cursor to the end of the line. */
-    system("tput el");
-}
+struct follower {
+    char* fname;    /* The name of the followed file. */
+    int ifd;        /* The inotify descriptor. */
+    int fwd;        /* The watch on the file. */
+    int fd;         /* The descriptor of the file being read. */
+    dev_t dev;      /* The device of the file being read. */
+    ino_t ino;      /* The inode of the file being read. */
+    off_t off;      /* The offset of the next byte to read. */
+    char* buf;      /* The read buffer. */
+    size_t cap;     /* The allocated size of the buffer. */
+    size_t len;     /* The number of bytes of a partial line in the buffer. */
+};
 
 /**
- * This function clears the entire line that the terminal cursor is currently
- * on.
+ * This function opens the followed file and watches it, recording its
+ * identity so rotation can be noticed. It returns false if the file does
+ * not exist.
  */
-void clearfb()
+static bool follow_attach(follower* f)
 {
-    /* Clearing the line that the terminal cursor is currently on. */
-    clearf();
-    clearb();
+    struct stat st;     /* The status of the file. */
+    int fd;             /* The file's descriptor. */
+
+    /* Opening the file. */
+    if ((fd = open(f->fname, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        if (errno == ENOENT)
+            return false;
+        fail("openfollow", f->fname);
+    }
+    if (fstat(fd, &st) == -1)
+        fail("openfollow", f->fname);
+
+    /* Replacing the old file and its watch. */
+    if (f->fd != -1)
+        close(f->fd);
+    if (f->fwd != -1)
+        inotify_rm_watch(f->ifd, f->fwd);
+    f->fd = fd;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->off = 0;
+    f->len = 0;
+    /* Watching the file. If that fails, follows() polls it instead. */
+    f->fwd = inotify_add_watch(f->ifd, f->fname, 
+                               IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                               IN_DELETE_SELF);
+    return true;
 }
 
 /**
- * This function returns the number of rows and columns of the terminal.
+ * This function starts following the file that has a name that matches fname.
+ * If from_end is true only lines appended after this call are delivered.
+ * If there is an error it will be printed on stderr and the program is
+ * exited.
  */
-vec2d get_res()
+MYCUTILS_API follower* openfollow(char* fname, bool from_end)
 {
-    vec2d res;      /* Storage for the rows and columns. */
-    FILE* rfp;      /* File stream for the rows file. */
-    FILE* cfp;      /* File stream for the columns file. */
-    char rbuf[5];   /* The number of rows. */
-    char cbuf[5];   /* The number of columns. */
+    follower* f;    /* The follower. */
+    char* dir;      /* The directory containing the file. */
+    struct stat st; /* The status of the file. */
 
-    /* Creating a temporary directory to store the files. */
-    system("if [ ! -d temp/ ]; then\nmkdir temp/\nfi");
-
-    /* Writing the number of rows and columns to their files. */
-    system("tput lines >> temp/screen_rows.txt");
-    system("tput cols >> temp/screen_cols.txt");
+    /* Allocating memory. */
+    f = (follower*) malloc(sizeof(follower));
+    strfmt(&f->fname, "%s", fname);
+    f->cap = FOLLOW_BUF_SIZE;
+    f->buf = (char*) malloc(f->cap);
+    f->fd = -1;
+    f->fwd = -1;
 
-    /* Opening the files. */
-    rfp = openfs("temp/screen_rows.txt", "r");
-    cfp = openfs("temp/screen_cols.txt", "r");
+    /* Creating the inotify instance. */
+    if ((f->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+        fail("openfollow", fname);
 
-    /* Getting the number of rows and columns from the files. */
-    fgets(rbuf, sizeof(rbuf), rfp);
-    fgets(cbuf, sizeof(cbuf), cfp);
+    /* Watching the directory so a rotated file's replacement is seen. */
+    dir = dir_of(fname);
+    if (inotify_add_watch(f->ifd, dir, IN_CREATE | IN_MOVED_TO) == -1)
+        fail("openfollow", dir);
+    free(dir);
 
-    /* Converting the number of rows and columns to integers. */
-    res.x = atoi(cbuf); //strtol( cbuf, &end, 10 );
-    res.y = atoi(rbuf); //strtol( rbuf, &end, 10 );
+    /* Opening the file. */
+    if (!follow_attach(f))
+        fail("openfollow", fname);
 
-    /* Closing the files. */
-    closefs(rfp);
-    closefs(cfp);
+    /* Skipping what is already there if asked to. */
+    if (from_end && fstat(f->fd, &st) == 0)
+        f->off = st.st_size;
 
-    /* Deleting the files. */
-    system("rm -rf temp");
+    return f;
+}
 
-    /* Returning the number of rows and columns that the terminal has. */
-    return res;
+/**
+ * This function returns a file descriptor that becomes readable when the
+ * followed file may have changed, so a follower can be added to an event
+ * loop. Call follows() with a timeout of 0 when it is readable.
+ */
+MYCUTILS_API int follow_fd(follower* f)
+{
+    return f->ifd;
 }
 
 /**
- * This function moves the terminal cursor a number of rows or columns
- * equal to the number provided to the function, and in a direction that is
- * also provided.
+ * This function reads everything appended to the current file since the
+ * last read and calls cb for each complete line. It returns the number of
+ * lines delivered.
  */
-void move_cursor(enum directions direction, unsigned int n)
+static size_t follow_drain(follower* f, follow_cb cb, void* arg)
 {
-    char* cmd; /* The command. */
+    size_t lines;   /* The number of lines delivered. */
+    ssize_t n;      /* The number of bytes read. */
+    char* start;    /* The start of the current line. */
+    char* nl;       /* The end of the current line. */
+    char* end;      /* The end of the bytes in the buffer. */
 
-    /* Creating the command. */
-    switch (direction)
+    lines = 0;
+    for (;;)
     {
-        case ABOVE:
-            strfmt(&cmd, "tput cuu %d", n);
-            break;
-        case BELOW:
-            strfmt(&cmd, "tput cud %d", n);
-            break;
-        case BEFORE:
-            strfmt(&cmd, "tput cub %d", n);
-            break;
-        case AFTER:
-            strfmt(&cmd, "tput cuf %d", n);
-            break;
-    }
+        /* Growing the buffer if a partial line has filled it. */
+        if (f->len == f->cap)
+        {
+            f->cap *= 2;
+            f->buf = (char*) realloc(f->buf, f->cap);
+        }
 
-    /* Moving the cursor. */
-    system(cmd);
+        /* Reading only the new bytes, after any partial line. */
+        if ((n = pread(f->fd, f->buf + f->len, f->cap - f->len, f->off)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fail("follows", f->fname);
+        }
+        if (n == 0)
+            return lines;
+        f->off += n;
+        end = f->buf + f->len + n;
 
-    /* Cleaning up. */
-    free(cmd);
+        /* Delivering the complete lines straight from the buffer. */
+        start = f->buf;
+        while ((nl = memchr(start, '\n', end - start)) != NULL)
+        {
+            cb(start, nl - start, arg);
+            lines++;
+            start = nl + 1;
+        }
+
+        /* Keeping the partial line at the front of the buffer. */
+        f->len = end - start;
+        memmove(f->buf, start, f->len);
+    }
 }
 
 /**
- * This function prints the text file at the file path provided to it. It
- * prints the text file in the colours and mode that are provided to
- * the function.
+ * This function waits up to timeout milliseconds (-1 waits forever) for the
+ * followed file to change, then calls cb for each complete line appended
+ * since the last call. It follows the file across rotation and truncation.
+ * If the file can't be watched, for example because there are no inotify
+ * watches left, it is checked every FOLLOW_POLL_MS milliseconds instead.
+ * It returns the number of lines delivered.
  */
-void print_fs_mod(char* filepath, vec2d origin, enum termcolours colour, 
-                                                enum textmodes mode)
+MYCUTILS_API size_t follows(follower* f, int timeout, follow_cb cb, void* arg)
 {
-    FILE* fs;   /* Pointer to the file stream. */
-    char* line; /* The text in the file. */
+    char events[4096];  /* Storage for the inotify events. */
+    struct pollfd pfd;  /* The inotify descriptor to wait on. */
+    struct stat st;     /* The status of a file. */
+    size_t lines;       /* The number of lines delivered. */
+    size_t partial;     /* The length of the old file's unfinished line. */
 
-    /* Ensuring that the buffer is set to NULL. */
-    line = NULL;
-    
-    /* Opening the file. */ 
-    fs = openfs(filepath, "r");
-
-    /* Setting the text mode and foreground colour. */
-    text_mode(mode);
-    text_fcol(colour);
+    /* Waiting for something to happen, then discarding the events. Their
+     * details don't matter because the file's state is checked directly.
+     * A file without a watch sends no events, so it is polled. */
+    if (f->fwd == -1 && (timeout < 0 || timeout > FOLLOW_POLL_MS))
+        timeout = FOLLOW_POLL_MS;
+    pfd.fd = f->ifd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout) == -1 && errno != EINTR)
+        fail("follows", f->fname);
+    while (read(f->ifd, events, sizeof(events)) > 0)
+        ;
 
-    /* Reading the line from the file. */ 
-    while (readfsl(fs, &line)) 
+    /* Starting again from the beginning if the file was truncated. */
+    if (fstat(f->fd, &st) == 0 && st.st_size < f->off)
     {
-        /* Drawing the line. */
-        print_str(line, origin);
-
-        /* Getting ready to draw the next line. */
-        origin.y++;
-        free(line);
-        line = NULL;
+        f->off = 0;
+        f->len = 0;
     }
 
-    /* Changing the text-mode and colour back to normal. */
-    text_mode(NORMAL);
+    /* Reading what was appended to the current file. */
+    lines = follow_drain(f, cb, arg);
 
-    /* Closing the file. */
-    closefs(fs);
+    /* Moving on to the new file if the old one was rotated away. It is
+     * drained first so no lines written before the rotation are lost, and
+     * its last line is delivered even if it has no newline, since nothing
+     * more will be read from it. Attaching leaves the buffer as it is. */
+    partial = f->len;
+    if (stat(f->fname, &st) == 0 && 
+        (st.st_ino != f->ino || st.st_dev != f->dev) && follow_attach(f))
+    {
+        if (partial > 0)
+        {
+            cb(f->buf, partial, arg);
+            lines++;
+        }
+        lines += follow_drain(f, cb, arg);
+    }
+
+    return lines;
 }
 
 /**
- * This function prints the string provided to it at the position that is
- * also provided to the function.
+ * This function stops following a file and frees the follower.
  */
-void print_str(char* str, vec2d pos)
+MYCUTILS_API void closefollow(follower* f)
 {
-    char* cmd;  // The command
-
-    /* Printing the string. */
-    put_cursor(pos.x, pos.y);
-    strfmt(&cmd, "printf \"%s\"", str);
-    system(cmd);
-
-    /* Cleaning up. */
-    free(cmd);
+    close(f->fd);
+    close(f->ifd);
+    free(f->fname);
+    free(f->buf);
+    free(f);
 }
 
 /**
- * This function prints the string provided to it at the position
- * that is also provided. It prints the string in the colours and in the
- * mode provided.
+ * This is a file opened for reading lines. Only the members used by its mode
+ * are set.
  */
-void print_str_mod(char* str, vec2d pos, enum termcolours fcol,
-                                         enum textmodes mode)
-{
-    /* Setting the text mode and foreground colour. */
-    text_mode(mode);
-    text_fcol(fcol);
+struct reader {
+    enum readmodes mode;    /* How the file is read. */
+    char* fname;            /* The name of the file. */
+    FILE* fs;               /* The stream of a READ_STDIO reader. */
+    int fd;                 /* The descriptor of a READ_BUFFERED reader. */
+    char* buf;              /* The line or read buffer. */
+    size_t cap;             /* The allocated size of the buffer. */
+    char* pos;              /* The next unread byte. */
+    char* end;              /* The end of the readable bytes. */
+    bool eof;               /* Whether a READ_BUFFERED reader hit EOF. */
+    void* map;              /* The mapping of a READ_MMAP reader. */
+    size_t size;            /* The size of the mapping. */
+    char* ahead;            /* The end of the part being read ahead. */
+};
 
-    /* Printing the string. */
-    print_str(str, pos);
+/**
+ * This function asks the kernel to read the next READ_AHEAD_SIZE bytes of
+ * the mapped file of the reader provided to it.
+ */
+static void rdahead(reader* r)
+{
+    size_t len; /* The length of the window. */
 
-    /* Reverting changes to the textcolours and mode. */
-    text_mode(NORMAL);
+    len = r->end - r->ahead < READ_AHEAD_SIZE ? 
+          (size_t) (r->end - r->ahead) : READ_AHEAD_SIZE;
+    madvise(r->ahead, len, MADV_WILLNEED);
+    r->ahead += len;
 }
 
-
 /**
- * This function places the terminal at the row and column numbers
+ * This function maps the whole of the file open on fd into the reader
+ * provided to it, advising the kernel of how it will be read.
+ */
+static void rdmap(reader* r, int fd, enum readhints hint)
+{
+    int flags;  /* The mapping flags. */
+
+    /* Prefaulting small hot files so reading them never page faults. */
+    flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (hint == READ_HOT && r->size <= READ_POPULATE_MAX)
+        flags |= MAP_POPULATE;
+#endif
+
+    /* Mapping the file. */
+    if ((r->map = mmap(NULL, r->size, PROT_READ, flags, fd, 0)) == MAP_FAILED)
+        fail("openrd", r->fname);
+
+    /* Advising the kernel of the access pattern. */
+    madvise(r->map, r->size, 
+            hint == READ_RANDOM ? MADV_RANDOM : MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (r->size >= 2 * 1024 * 1024)
+        madvise(r->map, r->size, MADV_HUGEPAGE);
+#endif
+
+    r->pos = (char*) r->map;
+    r->end = r->pos + r->size;
+
+    /* Reading ahead the first window of a file read in order. The rest of
+     * the file is read ahead as the reader moves through it, so a huge
+     * file isn't read in all at once. */
+    r->ahead = r->pos;
+    if (hint == READ_SEQUENTIAL)
+        rdahead(r);
+    else
+        r->ahead = r->end;
+}
+
+/**
+ * This function opens the file that has a name that matches fname for
+ * reading. It chooses how the file will be read from the file's size and the
+ * hint provided to it, and advises the kernel of the access pattern.
+ * If there is an error it will be printed on stderr and the program is
+ * exited.
+ */
+MYCUTILS_API reader* openrd(char* fname, enum readhints hint)
+{
+    reader* r;      /* The reader. */
+    struct stat st; /* The status of the file. */
+    int fd;         /* The file's descriptor. */
+
+    /* Allocating memory. */
+    r = (reader*) calloc(1, sizeof(reader));
+    strfmt(&r->fname, "%s", fname);
+
+    /* Opening the file and getting its size. */
+    if ((fd = open(fname, O_RDONLY | O_CLOEXEC)) == -1 || 
+        fstat(fd, &st) == -1)
+        fail("openrd", fname);
+    r->size = st.st_size;
+
+    /* Choosing how to read the file. Hot files and files read out of order
+     * are mapped unless they are tiny, large files are mapped, mid-sized ones
+     * are read in big chunks and small ones go through stdio. */
+    if (r->size == 0 || !S_ISREG(st.st_mode))
+        r->mode = READ_STDIO;
+    else if (hint != READ_SEQUENTIAL && r->size >= READ_STDIO_MAX)
+        r->mode = READ_MMAP;
+    else if (hint == READ_HOT && r->size <= READ_POPULATE_MAX)
+        r->mode = READ_MMAP;
+    else if (r->size < READ_STDIO_MAX)
+        r->mode = READ_STDIO;
+    else if (r->size >= READ_MMAP_MIN)
+        r->mode = READ_MMAP;
+    else
+        r->mode = READ_BUFFERED;
+
+    /* Setting up the chosen strategy. */
+    switch (r->mode)
+    {
+        case READ_STDIO:
+            if ((r->fs = fdopen(fd, "r")) == NULL)
+                fail("openrd", fname);
+            break;
+
+        case READ_BUFFERED:
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            r->fd = fd;
+            r->cap = READ_BUF_SIZE;
+            r->buf = (char*) big_alloc(r->cap, true);
+            r->pos = r->end = r->buf;
+            break;
+
+        case READ_MMAP:
+            rdmap(r, fd, hint);
+            close(fd);
+            break;
+    }
+
+    return r;
+}
+
+/**
+ * This function returns how the reader provided to it reads its file.
+ */
+MYCUTILS_API enum readmodes rdmode(reader* r)
+{
+    return r->mode;
+}
+
+/**
+ * This function refills the buffer of a READ_BUFFERED reader, keeping the
+ * unread bytes. It returns false if no more bytes could be read.
+ */
+static bool rdfill(reader* r)
+{
+    size_t left;    /* The number of unread bytes. */
+    ssize_t n;      /* The number of bytes read. */
+
+    if (r->eof)
+        return false;
+
+    /* Moving the unread bytes to the front, growing the buffer if they fill
+     * it. */
+    left = r->end - r->pos;
+    memmove(r->buf, r->pos, left);
+    if (left == r->cap)
+    {
+        r->buf = (char*) big_realloc(r->buf, r->cap, r->cap * 2);
+        r->cap *= 2;
+    }
+
+    /* Reading the next chunk of the file. */
+    while ((n = read(r->fd, r->buf + left, r->cap - left)) < 0)
+        if (errno != EINTR)
+            fail("readrdl", r->fname);
+    if (n == 0)
+        r->eof = true;
+
+    r->pos = r->buf;
+    r->end = r->buf + left + n;
+    return n > 0;
+}
+
+/**
+ * This function points line at the next line in the reader provided to it
+ * and stores its length, without the newline, in len. The line is not
+ * null-terminated and is only valid until the next call. It returns true if
+ * a line was read or false if EOF was reached. If an error occurs the program
+ * will exit.
+ */
+MYCUTILS_API bool readrdl(reader* r, const char** line, size_t* len)
+{
+    ssize_t n;  /* The length of a line read by getline(). */
+    char* nl;   /* The end of the line. */
+
+    /* Reading through stdio. */
+    if (r->mode == READ_STDIO)
+    {
+        if ((n = getline(&r->buf, &r->cap, r->fs)) == -1)
+        {
+            if (ferror(r->fs))
+                fail("readrdl", r->fname);
+            return false;
+        }
+        *line = r->buf;
+        *len = n > 0 && r->buf[n - 1] == '\n' ? n - 1 : n;
+        return true;
+    }
+
+    /* Finding the end of the line, refilling a buffered reader until the
+     * whole line is in the buffer. */
+    while ((nl = memchr(r->pos, '\n', r->end - r->pos)) == NULL)
+    {
+        if (r->mode == READ_MMAP || !rdfill(r))
+        {
+            /* Returning a last line that has no newline. */
+            if (r->pos == r->end)
+                return false;
+            *line = r->pos;
+            *len = r->end - r->pos;
+            r->pos = r->end;
+            return true;
+        }
+    }
+
+    *line = r->pos;
+    *len = nl - r->pos;
+    r->pos = nl + 1;
+
+    /* Reading ahead the next window of a mapped file half way through the
+     * last one. */
+    if (r->mode == READ_MMAP && r->ahead < r->end && 
+        r->ahead - r->pos <= READ_AHEAD_SIZE / 2)
+        rdahead(r);
+    return true;
+}
+
+/**
+ * This function closes the reader provided to it.
+ */
+MYCUTILS_API void closerd(reader* r)
+{
+    switch (r->mode)
+    {
+        case READ_STDIO     : closefs(r->fs); break;
+        case READ_BUFFERED  : close(r->fd); break;
+        case READ_MMAP      : munmap(r->map, r->size); break;
+    }
+    if (r->mode == READ_BUFFERED)
+        big_free(r->buf, r->cap);
+    else
+        free(r->buf);
+    free(r->fname);
+    free(r);
+}
+
+/**
+ * This is a direct writer. The caller fills one block while the background
+ * thread writes the other.
+ */
+struct dwriter {
+    char* fname;            /* The name of the file. */
+    int fd;                 /* The file's descriptor. */
+    bool direct;            /* Whether the file was opened with O_DIRECT. */
+    char* blocks[2];        /* The aligned staging blocks. */
+    int cur;                /* The block being filled. */
+    size_t fill;            /* The number of bytes in the current block. */
+    off_t off;              /* The file offset of the current block. */
+    pthread_t thread;       /* The thread that writes full blocks. */
+    pthread_mutex_t lock;   /* Protects the members below. */
+    pthread_cond_t cond;    /* Signalled when a job starts or finishes. */
+    bool busy;              /* Whether a block is being written. */
+    bool quit;              /* Whether the thread should finish. */
+    int err;                /* The errno of a failed write, or 0. */
+    char* job;              /* The block being written. */
+    size_t joblen;          /* The number of bytes to write. */
+    off_t joboff;           /* The offset to write them at. */
+};
+
+/**
+ * This function is run by a direct writer's background thread. It writes
+ * each block it is handed, then waits for the next one.
+ */
+static void* dwthread(void* arg)
+{
+    dwriter* w;     /* The direct writer. */
+    size_t done;    /* The number of bytes of the job written. */
+    ssize_t n;      /* The number of bytes written by one call. */
+    int err;        /* The errno of a failed write. */
+
+    w = (dwriter*) arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;)
+    {
+        /* Waiting for a block or to be told to finish. */
+        while (!w->busy && !w->quit)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->busy)
+            break;
+        pthread_mutex_unlock(&w->lock);
+
+        /* Writing the block. */
+        err = 0;
+        for (done = 0; done < w->joblen; done += n)
+        {
+            n = pwrite(w->fd, w->job + done, w->joblen - done, 
+                       w->joboff + done);
+            if (n < 0 && errno == EINTR)
+                n = 0;
+            else if (n <= 0)
+            {
+                err = n < 0 ? errno : EIO;
+                break;
+            }
+        }
+
+        /* Dropping the block from the page cache if it went through it. */
+        if (!w->direct && err == 0)
+        {
+            sync_file_range(w->fd, w->joboff, w->joblen, 
+                            SYNC_FILE_RANGE_WAIT_BEFORE | 
+                            SYNC_FILE_RANGE_WRITE | 
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(w->fd, w->joboff, w->joblen, POSIX_FADV_DONTNEED);
+        }
+
+        /* Telling the caller the block is free again. */
+        pthread_mutex_lock(&w->lock);
+        w->err = err;
+        w->busy = false;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+/**
+ * This function hands len bytes of the current block to the background
+ * thread once it has finished the previous block, then switches to the other
+ * block.
+ */
+static void dwsubmit(dwriter* w, size_t len)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->busy)
+        pthread_cond_wait(&w->cond, &w->lock);
+    if (w->err != 0)
+    {
+        errno = w->err;
+        fail("writedw", w->fname);
+    }
+    w->job = w->blocks[w->cur];
+    w->joblen = len;
+    w->joboff = w->off;
+    w->busy = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    w->off += len;
+    w->cur ^= 1;
+    w->fill = 0;
+}
+
+/**
+ * This function creates or truncates the file that has a name that matches
+ * fname and opens it for direct writing. Data is staged in aligned blocks
+ * that are written by a background thread while the next block fills. If
+ * the filesystem doesn't support O_DIRECT, the written ranges are dropped
+ * from the page cache instead. If there is an error it will be printed on
+ * stderr and the program is exited.
+ */
+MYCUTILS_API dwriter* opendw(char* fname)
+{
+    const int FLAGS = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    dwriter* w;     /* The direct writer. */
+    int b;          /* Index of the current block. */
+
+    /* Allocating memory. */
+    w = (dwriter*) calloc(1, sizeof(dwriter));
+    strfmt(&w->fname, "%s", fname);
+    for (b = 0; b < 2; b++)
+        w->blocks[b] = (char*) big_alloc(DIRECT_BLOCK_SIZE, true);
+
+    /* Opening the file, falling back to the page cache if the filesystem
+     * refuses O_DIRECT. */
+    w->direct = true;
+    if ((w->fd = open(fname, FLAGS | O_DIRECT, 0666)) == -1 && 
+        errno == EINVAL)
+    {
+        w->direct = false;
+        w->fd = open(fname, FLAGS, 0666);
+    }
+    if (w->fd == -1)
+        fail("opendw", fname);
+
+    /* Starting the background thread. */
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if ((errno = pthread_create(&w->thread, NULL, dwthread, w)) != 0)
+        fail("opendw", fname);
+
+    return w;
+}
+
+/**
+ * This function writes len bytes of data to the direct writer provided to it.
+ */
+MYCUTILS_API void writedw(dwriter* w, const char* data, size_t len)
+{
+    size_t n;   /* The number of bytes copied into the current block. */
+
+    while (len > 0)
+    {
+        /* Copying as much as fits into the current block. */
+        n = DIRECT_BLOCK_SIZE - w->fill;
+        if (n > len)
+            n = len;
+        memcpy(w->blocks[w->cur] + w->fill, data, n);
+        w->fill += n;
+        data += n;
+        len -= n;
+
+        /* Handing the block over once it is full. */
+        if (w->fill == DIRECT_BLOCK_SIZE)
+            dwsubmit(w, DIRECT_BLOCK_SIZE);
+    }
+}
+
+/**
+ * This function writes the string provided to it to the direct writer
  * provided to it.
  */
-void put_cursor(unsigned int col, unsigned int row)
+MYCUTILS_API void writedws(dwriter* w, char* str)
+{
+    writedw(w, str, strlen(str));
+}
+
+/**
+ * This function writes any staged data, including a final block that isn't
+ * a whole multiple of DIRECT_ALIGN, then closes the direct writer.
+ */
+MYCUTILS_API void closedw(dwriter* w)
 {
-    char* cmd;   /* The command. */
+    off_t size;     /* The final size of the file. */
+    size_t padded;  /* The length of the last block rounded up. */
+    int b;          /* Index of the current block. */
 
-    /* Setting the cursor position. */
-    strfmt(&cmd, "tput cup %d %d", row, col);
-    system(cmd);
+    /* Writing the tail padded out to the alignment O_DIRECT needs. The
+     * padding is cut off again below. */
+    size = w->off + w->fill;
+    if (w->fill > 0)
+    {
+        padded = (w->fill + DIRECT_ALIGN - 1) & ~((size_t) DIRECT_ALIGN - 1);
+        memset(w->blocks[w->cur] + w->fill, 0, padded - w->fill);
+        dwsubmit(w, padded);
+    }
+
+    /* Waiting for the last block, then stopping the thread. */
+    pthread_mutex_lock(&w->lock);
+    while (w->busy)
+        pthread_cond_wait(&w->cond, &w->lock);
+    w->quit = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    if (w->err != 0)
+    {
+        errno = w->err;
+        fail("closedw", w->fname);
+    }
+
+    /* Cutting off the padding and closing the file. */
+    if (ftruncate(w->fd, size) == -1 || close(w->fd) == -1)
+        fail("closedw", w->fname);
 
     /* Cleaning up. */
-    free(cmd); 
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    for (b = 0; b < 2; b++)
+        big_free(w->blocks[b], DIRECT_BLOCK_SIZE);
+    free(w->fname);
+    free(w);
 }
 
 /**
- * This function sets the background colour of the terminal cursor.
+ * This is the most bytes asked of the kernel in one copy call.
  */
-void text_bcol(enum termcolours c)
+#define COPY_CHUNK (1024 * 1024 * 1024)
+
+/**
+ * This function copies everything from the current offset of in to the end
+ * of the file, to the current offset of out, without the data entering this
+ * program. It uses copy_file_range() and falls back to sendfile() where the
+ * filesystems don't support it. It returns the number of bytes copied.
+ */
+static off_t fdcopy(int in, int out, char* func, char* fname)
 {
-    char* cmd;  /* The command. */
+    off_t total;    /* The number of bytes copied. */
+    ssize_t n;      /* The number of bytes copied by one call. */
+    bool fallback;  /* Whether copy_file_range() is unsupported. */
 
-    /* Setting the background colour. */
-    strfmt(&cmd, "tput setab %d", c);
-    system(cmd);
+    total = 0;
+    fallback = false;
+    for (;;)
+    {
+        /* Copying the next chunk. */
+        if (!fallback)
+        {
+            n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+            if (n == -1 && (errno == EXDEV || errno == ENOSYS || 
+                            errno == EINVAL || errno == EOPNOTSUPP))
+            {
+                fallback = true;
+                continue;
+            }
+        }
+        else
+            n = sendfile(out, in, NULL, COPY_CHUNK);
 
-    /* Cleaning up. */
-    free(cmd);
+        /* Finishing at the end of the source file. */
+        if (n == 0)
+            return total;
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            fail(func, fname);
+        }
+        total += n;
+    }
 }
 
 /**
- * This function sets the foreground colour of the temrinal cursor.
+ * This function opens the file named fname for copying the n files named in
+ * srcs into, truncating it if trunc is true and positioning at its end
+ * otherwise. If it is one of the sources the program fails with EINVAL
+ * before anything is truncated, since the copy would destroy or endlessly
+ * grow it.
  */
-void text_fcol(enum termcolours c)
+static int open_dst(char* fname, char** srcs, size_t n, bool trunc, 
+                    char* func)
 {
-    char* cmd;   /* The command. */
+    struct stat dst;    /* The status of the file. */
+    struct stat src;    /* The status of the current source. */
+    size_t f;           /* Index of the current source. */
+    int fd;             /* The file's descriptor. */
 
-    /* Setting the colour. */
-    strfmt(&cmd, "tput setaf %d", c);
-    system(cmd);
+    /* Opening the file. It isn't opened with O_APPEND because
+     * copy_file_range() refuses such files, nor with O_TRUNC until it is
+     * known not to be a source. */
+    if ((fd = open(fname, O_WRONLY | O_CREAT | O_CLOEXEC, 0666)) == -1 || 
+        fstat(fd, &dst) == -1)
+        fail(func, fname);
 
-    /* Cleaning up. */
-    free(cmd);
+    /* Refusing to copy a file into itself. Sources that can't be found are
+     * reported when they are opened. */
+    for (f = 0; f < n; f++)
+    {
+        if (stat(srcs[f], &src) == 0 && 
+            src.st_dev == dst.st_dev && src.st_ino == dst.st_ino)
+        {
+            errno = EINVAL;
+            fail(func, srcs[f]);
+        }
+    }
+
+    if ((trunc && ftruncate(fd, 0) == -1) || lseek(fd, 0, SEEK_END) == -1)
+        fail(func, fname);
+    return fd;
+}
+
+/**
+ * This function appends the file named src to the file open on out. It
+ * returns the number of bytes appended.
+ */
+static off_t append_fd(char* src, int out, char* func)
+{
+    int in;         /* The source file's descriptor. */
+    off_t total;    /* The number of bytes copied. */
+
+    if ((in = open(src, O_RDONLY | O_CLOEXEC)) == -1)
+        fail(func, src);
+    total = fdcopy(in, out, func, src);
+    close(in);
+    return total;
+}
+
+/**
+ * This function replaces the file named dst with a copy of the file named
+ * src. The kernel moves the data without it passing through this program,
+ * sharing the source's blocks when the filesystem supports reflinks. It
+ * returns the number of bytes copied. If there is an error, including src
+ * and dst being the same file, it will be printed on stderr and the
+ * program is exited.
+ */
+MYCUTILS_API off_t copyfs(char* src, char* dst)
+{
+    int in;         /* The source file's descriptor. */
+    int out;        /* The destination file's descriptor. */
+    struct stat st; /* The status of the source file. */
+    off_t total;    /* The number of bytes copied. */
+
+    /* Opening the files. */
+    if ((in = open(src, O_RDONLY | O_CLOEXEC)) == -1 || fstat(in, &st) == -1)
+        fail("copyfs", src);
+    out = open_dst(dst, &src, 1, true, "copyfs");
+
+    /* Sharing the source's blocks if the filesystem can, otherwise
+     * copying them. */
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0)
+        total = st.st_size;
+    else
+#endif
+        total = fdcopy(in, out, "copyfs", src);
+
+    /* Closing the files. */
+    close(in);
+    if (close(out) == -1)
+        fail("copyfs", dst);
+
+    return total;
+}
+
+/**
+ * This function appends the file named src to the file named dst, creating
+ * dst if it doesn't exist. It returns the number of bytes appended. If there
+ * is an error, including src and dst being the same file, it will be
+ * printed on stderr and the program is exited.
+ */
+MYCUTILS_API off_t appendfs(char* src, char* dst)
+{
+    int out;        /* The destination file's descriptor. */
+    off_t total;    /* The number of bytes copied. */
+
+    /* Copying the source onto the end of the destination. */
+    out = open_dst(dst, &src, 1, false, "appendfs");
+    total = append_fd(src, out, "appendfs");
+
+    /* Closing the destination. */
+    if (close(out) == -1)
+        fail("appendfs", dst);
+
+    return total;
+}
+
+/**
+ * This function replaces the file named dst with the n files named in srcs
+ * joined end to end. It returns the number of bytes written. If there is an
+ * error, including dst being one of the sources, it will be printed on
+ * stderr and the program is exited.
+ */
+MYCUTILS_API off_t concatfs(char** srcs, size_t n, char* dst)
+{
+    int out;        /* The destination file's descriptor. */
+    off_t total;    /* The number of bytes copied. */
+    size_t f;       /* Index of the current source file. */
+
+    /* Copying each source onto the end of the destination. */
+    out = open_dst(dst, srcs, n, true, "concatfs");
+    total = 0;
+    for (f = 0; f < n; f++)
+        total += append_fd(srcs[f], out, "concatfs");
+
+    /* Closing the destination. */
+    if (close(out) == -1)
+        fail("concatfs", dst);
+
+    return total;
+}
+
+/**
+ * This function opens the file that has a name that matches fname as a
+ * byte stream. If there is an error it will be printed on stderr and the
+ * program is exited.
+ */
+MYCUTILS_API bstream* openbs(char* fname)
+{
+    bstream* bs;    /* The byte stream. */
+
+    /* Allocating memory. */
+    bs = (bstream*) malloc(sizeof(bstream));
+    strfmt(&bs->fname, "%s", fname);
+    bs->buf = (unsigned char*) malloc(BSTREAM_BUF_SIZE + 1);
+    bs->pos = bs->end = bs->buf + 1;
+
+    /* Opening the file. */
+    if ((bs->fd = open(fname, O_RDONLY | O_CLOEXEC)) == -1)
+        fail("openbs", fname);
+    posix_fadvise(bs->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    return bs;
+}
+
+/**
+ * This function refills an empty byte stream's buffer, keeping the last byte
+ * read so it can still be unread. It returns false if EOF was reached. If an
+ * error occurs the program will exit.
+ */
+MYCUTILS_API bool bsfill(bstream* bs)
+{
+    ssize_t n;  /* The number of bytes read. */
+
+    /* Keeping the last byte read for bsunread(). */
+    bs->buf[0] = bs->pos[-1];
+
+    /* Reading the next chunk of the file. */
+    while ((n = read(bs->fd, bs->buf + 1, BSTREAM_BUF_SIZE)) == -1)
+        if (errno != EINTR)
+            fail("bsfill", bs->fname);
+
+    bs->pos = bs->buf + 1;
+    bs->end = bs->pos + n;
+    return n > 0;
+}
+
+/**
+ * This function closes the byte stream provided to it.
+ */
+MYCUTILS_API void closebs(bstream* bs)
+{
+    close(bs->fd);
+    free(bs->fname);
+    free(bs->buf);
+    free(bs);
+}
+
+/******************************** Memory *************************************/
+
+/**
+ * This asks for 2 MB pages specifically, rather than the default huge page
+ * size, which may be larger.
+ */
+#if defined(MAP_HUGE_SHIFT)
+#define BIG_MAP_HUGE (MAP_HUGETLB | (21 << MAP_HUGE_SHIFT))
+#elif defined(MAP_HUGETLB)
+#define BIG_MAP_HUGE MAP_HUGETLB
+#endif
+
+/**
+ * Whether transparent huge pages may be used, which is checked once.
+ */
+static bool big_thp;
+static pthread_once_t big_thp_once = PTHREAD_ONCE_INIT;
+
+/**
+ * The size of the pages backing the most recent large buffer.
+ */
+static size_t big_last_page;
+
+/**
+ * This function reads the first line of the sysfs file at path into buf,
+ * which holds size bytes. It returns false if it can't.
+ */
+static bool read_sysfs(const char* path, char* buf, size_t size)
+{
+    FILE* fs;   /* The file. */
+    bool ok;    /* Whether a line was read. */
+
+    if ((fs = fopen(path, "r")) == NULL)
+        return false;
+    ok = fgets(buf, size, fs) != NULL;
+    fclose(fs);
+    return ok;
+}
+
+/**
+ * This function checks whether the kernel will back memory advised with
+ * MADV_HUGEPAGE by transparent huge pages.
+ */
+static void big_thp_init()
+{
+    char buf[64];   /* The kernel's setting. */
+
+    big_thp = read_sysfs("/sys/kernel/mm/transparent_hugepage/enabled", 
+                         buf, sizeof(buf)) && strstr(buf, "[never]") == NULL;
+}
+
+/**
+ * This function returns the length of the mapping for a large buffer of the
+ * size provided.
+ */
+static size_t big_length(size_t size)
+{
+    size_t page;    /* The size of the pages. */
+
+    page = BIG_HUGE_PAGES && size >= HUGE_PAGE_SIZE ? 
+           HUGE_PAGE_SIZE : (size_t) getpagesize();
+    return (size + page - 1) & ~(page - 1);
+}
+
+/**
+ * This function maps size bytes of memory, using huge pages where it can,
+ * and stores the size of the pages used in pagesize. It returns NULL if the
+ * memory can't be mapped.
+ */
+static char* big_map(size_t size, size_t* pagesize)
+{
+    const int PROT = PROT_READ | PROT_WRITE;
+    const int FLAGS = MAP_PRIVATE | MAP_ANONYMOUS;
+    size_t len;     /* The length of the mapping. */
+    size_t lead;    /* The bytes mapped before the aligned start. */
+    char* mem;      /* The memory. */
+
+    len = big_length(size);
+    *pagesize = getpagesize();
+    if (!BIG_HUGE_PAGES || size < HUGE_PAGE_SIZE)
+        return (mem = (char*) mmap(NULL, len, PROT, FLAGS, -1, 0)) == 
+               MAP_FAILED ? NULL : mem;
+
+    /* Taking huge pages from the hugetlb pool. The pages are reserved when
+     * the mapping is made, so this fails now rather than on a later fault if
+     * the pool is empty. */
+#ifdef BIG_MAP_HUGE
+    if ((mem = (char*) mmap(NULL, len, PROT, FLAGS | BIG_MAP_HUGE, -1, 0)) != 
+        MAP_FAILED)
+    {
+        *pagesize = HUGE_PAGE_SIZE;
+        return mem;
+    }
+#endif
+
+    /* Otherwise mapping normal memory aligned to a huge page, which is
+     * needed for transparent huge pages to back it, by mapping a huge page
+     * more than needed and cutting off the ends. */
+    if ((mem = (char*) mmap(NULL, len + HUGE_PAGE_SIZE, PROT, FLAGS, -1, 0)) 
+        == MAP_FAILED)
+        return NULL;
+    lead = -(uintptr_t) mem & (HUGE_PAGE_SIZE - 1);
+    if (lead > 0)
+        munmap(mem, lead);
+    munmap(mem + lead + len, HUGE_PAGE_SIZE - lead);
+    mem += lead;
+
+    /* Asking for transparent huge pages. */
+#ifdef MADV_HUGEPAGE
+    pthread_once(&big_thp_once, big_thp_init);
+    if (big_thp && madvise(mem, len, MADV_HUGEPAGE) == 0)
+        *pagesize = HUGE_PAGE_SIZE;
+#endif
+    return mem;
+}
+
+/**
+ * This function faults in every page of the len bytes of memory provided so
+ * that the first pass over a buffer doesn't pay for its page faults.
+ */
+static void big_prefault(char* mem, size_t len)
+{
+    size_t i;       /* Offset of the current page. */
+    long pagesize;  /* The size of a page. */
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(mem, len, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    pagesize = getpagesize();
+    for (i = 0; i < len; i += pagesize)
+        ((volatile char*) mem)[i] = 0;
+}
+
+/**
+ * This function maps size bytes of memory for a large buffer. Buffers of at
+ * least HUGE_PAGE_SIZE are backed by huge pages from the hugetlb pool if any
+ * are free, or else aligned and advised for transparent huge pages. If
+ * prefault is true every page is faulted in before the function returns.
+ * It returns NULL if size is 0. The memory must be freed with big_free().
+ * If there is an error it will be printed on stderr and the program is
+ * exited.
+ */
+MYCUTILS_API void* big_alloc(size_t size, bool prefault)
+{
+    char* mem;          /* The memory. */
+    size_t pagesize;    /* The size of the pages backing it. */
+
+    if (size == 0)
+        return NULL;
+    if ((mem = big_map(size, &pagesize)) == NULL)
+        fail("big_alloc", "mmap");
+    __atomic_store_n(&big_last_page, pagesize, __ATOMIC_RELAXED);
+    if (prefault)
+        big_prefault(mem, big_length(size));
+    return mem;
+}
+
+/**
+ * This function moves the large buffer provided to it, which holds old
+ * bytes, into a new one of size bytes and returns the new buffer.
+ */
+MYCUTILS_API void* big_realloc(void* mem, size_t old, size_t size)
+{
+    void* grown;    /* The new buffer. */
+
+    grown = big_alloc(size, false);
+    if (grown != NULL && mem != NULL)
+        memcpy(grown, mem, old < size ? old : size);
+    big_free(mem, old);
+    return grown;
+}
+
+/**
+ * This function frees the large buffer of the size provided. Freeing NULL
+ * does nothing.
+ */
+MYCUTILS_API void big_free(void* mem, size_t size)
+{
+    if (mem != NULL)
+        munmap(mem, big_length(size));
+}
+
+/**
+ * This function returns the size of the pages backing the most recently
+ * allocated large buffer. It is HUGE_PAGE_SIZE if huge pages were used and
+ * the normal page size otherwise.
+ */
+MYCUTILS_API size_t big_page_size()
+{
+    size_t pagesize;    /* The size of the pages. */
+
+    if ((pagesize = __atomic_load_n(&big_last_page, __ATOMIC_RELAXED)) == 0)
+        pagesize = getpagesize();
+    return pagesize;
+}
+
+/******************************** Threads ************************************/
+
+/**
+ * These are for binding memory to a node without libnuma.
+ */
+#define POOL_MPOL_PREFERRED 1
+#define POOL_NODE_BITS 1024
+
+/**
+ * This is a task waiting in a queue.
+ */
+typedef struct {
+    pool_fn fn;         /* The function to call. */
+    void* arg;          /* Its argument. */
+    taskgroup* group;   /* The group the task is counted in, if any. */
+} pooltask;
+
+/**
+ * This is a NUMA node of a pool, with its queue of tasks.
+ */
+typedef struct {
+    int id;                         /* The node's number in sysfs. */
+    cpu_set_t cpus;                 /* The node's CPUs. */
+    int order[POOL_MAX_NODES];      /* The other nodes, nearest first. */
+    pooltask* tasks;                /* The queue, as a ring. */
+    size_t cap;                     /* The queue's capacity. */
+    size_t head;                    /* Index of the first task. */
+    size_t count;                   /* The number of tasks queued. */
+    unsigned idle;                  /* The node's workers with no work. */
+    pthread_cond_t wake;            /* Wakes the node's workers. */
+} poolnode;
+
+/**
+ * This is a worker thread of a pool.
+ */
+typedef struct {
+    pool* p;            /* The pool. */
+    int node;           /* The worker's node. */
+    pthread_t thread;   /* The thread. */
+} poolworker;
+
+/**
+ * This is a pool of worker threads. One lock protects every queue, since
+ * tasks are expected to be much longer than the time it is held.
+ */
+struct pool {
+    pthread_mutex_t lock;               /* Protects everything below. */
+    pthread_cond_t done;                /* Signalled when a group finishes. */
+    poolnode nodes[POOL_MAX_NODES];     /* The nodes. */
+    int nnodes;                         /* The number of nodes. */
+    unsigned next;                      /* The node for the next task. */
+    poolworker* workers;                /* The workers. */
+    unsigned nworkers;                  /* The number of workers. */
+    bool stop;                          /* Whether the workers should stop. */
+};
+
+/**
+ * The pool used by the library's parallel functions.
+ */
+static pool* lib_pool;
+static pthread_once_t lib_pool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * This function adds the CPUs or nodes in the list provided to it, such as
+ * "0-3,8-11", to set.
+ */
+static void parse_cpulist(const char* list, cpu_set_t* set)
+{
+    char* end;  /* The end of the current number. */
+    long a;     /* The start of the current range. */
+    long b;     /* The end of the current range. */
+
+    CPU_ZERO(set);
+    while (*list >= '0' && *list <= '9')
+    {
+        a = b = strtol(list, &end, 10);
+        if (*end == '-')
+            b = strtol(end + 1, &end, 10);
+        for (; a <= b && a < CPU_SETSIZE; a++)
+            CPU_SET(a, set);
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+/**
+ * This function finds the NUMA nodes with CPUs the process may use, filling
+ * in the nodes of the pool provided with their CPUs and the order in which
+ * their workers take tasks from other nodes. A machine without NUMA is one
+ * node.
+ */
+static void pool_topology(pool* p)
+{
+    char buf[8192];                     /* A line from sysfs. */
+    cpu_set_t allowed;                  /* The CPUs the process may use. */
+    cpu_set_t online;                   /* The online nodes. */
+    int dist[POOL_MAX_NODES][POOL_MAX_NODES];   /* Distances between nodes. */
+    int pos[POOL_MAX_NODES];            /* Each node's place in online. */
+    char path[64];                      /* The path of a sysfs file. */
+    char* s;                            /* The current distance. */
+    int id;                             /* The current node in sysfs. */
+    int n;                              /* The current online node. */
+    int i;                              /* Index of a node. */
+    int j;                              /* Index of another node. */
+    int k;                              /* Index in a node's order. */
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        CPU_ZERO(&allowed);
+        for (i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); i++)
+            CPU_SET(i, &allowed);
+    }
+
+    /* Finding the online nodes with CPUs the process may use. */
+    p->nnodes = 0;
+    if (read_sysfs("/sys/devices/system/node/online", buf, sizeof(buf)))
+    {
+        parse_cpulist(buf, &online);
+        for (id = 0, n = 0; id < CPU_SETSIZE && p->nnodes < POOL_MAX_NODES;
+             id++)
+        {
+            if (!CPU_ISSET(id, &online))
+                continue;
+            snprintf(path, sizeof(path), 
+                     "/sys/devices/system/node/node%d/cpulist", id);
+            if (read_sysfs(path, buf, sizeof(buf)))
+            {
+                parse_cpulist(buf, &p->nodes[p->nnodes].cpus);
+                CPU_AND(&p->nodes[p->nnodes].cpus, 
+                        &p->nodes[p->nnodes].cpus, &allowed);
+                if (CPU_COUNT(&p->nodes[p->nnodes].cpus) > 0)
+                {
+                    p->nodes[p->nnodes].id = id;
+                    pos[p->nnodes++] = n;
+                }
+            }
+            n++;
+        }
+    }
+    if (p->nnodes == 0)
+    {
+        p->nnodes = 1;
+        p->nodes[0].id = 0;
+        p->nodes[0].cpus = allowed;
+        pos[0] = 0;
+    }
+
+    /* Reading the distances between them. Each node's distance file lists
+     * its distance to every online node. */
+    for (i = 0; i < p->nnodes; i++)
+    {
+        for (j = 0; j < p->nnodes; j++)
+            dist[i][j] = i > j ? i - j : j - i;
+        snprintf(path, sizeof(path), 
+                 "/sys/devices/system/node/node%d/distance", p->nodes[i].id);
+        if (!read_sysfs(path, buf, sizeof(buf)))
+            continue;
+        for (j = 0; j < p->nnodes; j++)
+        {
+            for (s = buf, n = 0; n < pos[j] && *s; n++)
+                strtol(s, &s, 10);
+            if (*s)
+                dist[i][j] = strtol(s, NULL, 10);
+        }
+    }
+
+    /* Ordering the other nodes by distance. */
+    for (i = 0; i < p->nnodes; i++)
+    {
+        for (j = 0, n = 0; j < p->nnodes; j++)
+        {
+            if (j == i)
+                continue;
+            for (k = n++; k > 0 && dist[i][p->nodes[i].order[k - 1]] > 
+                                   dist[i][j]; k--)
+                p->nodes[i].order[k] = p->nodes[i].order[k - 1];
+            p->nodes[i].order[k] = j;
+        }
+    }
+}
+
+/**
+ * This function takes the next task for a thread on the node provided from
+ * the pool provided, taking one from other nodes, nearest first, if steal
+ * is true and the node has none. The pool must be locked. It returns false
+ * if there are none.
+ */
+static bool pool_take(pool* p, int node, bool steal, pooltask* task)
+{
+    poolnode* n;    /* The node taken from. */
+    int k;          /* Index in the node's order. */
+
+    n = &p->nodes[node];
+    for (k = 0; n->count == 0; k++)
+    {
+        if (!steal || k == p->nnodes - 1)
+            return false;
+        n = &p->nodes[p->nodes[node].order[k]];
+    }
+    *task = n->tasks[n->head];
+    n->head = (n->head + 1) % n->cap;
+    n->count--;
+    return true;
+}
+
+/**
+ * This function runs the task provided, unlocking the pool provided while
+ * it runs, and counts it as finished.
+ */
+static void pool_run(pool* p, pooltask* task)
+{
+    pthread_mutex_unlock(&p->lock);
+    task->fn(task->arg);
+    pthread_mutex_lock(&p->lock);
+    if (task->group && --task->group->pending == 0)
+        pthread_cond_broadcast(&p->done);
+}
+
+/**
+ * This function is run by each worker. It runs tasks until the pool is
+ * stopped and has none left.
+ */
+static void* pool_worker(void* arg)
+{
+    poolworker* w;  /* The worker. */
+    pool* p;        /* The worker's pool. */
+    pooltask task;  /* The current task. */
+
+    w = (poolworker*) arg;
+    p = w->p;
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        if (pool_take(p, w->node, true, &task))
+            pool_run(p, &task);
+        else if (p->stop)
+            break;
+        else
+        {
+            p->nodes[w->node].idle++;
+            pthread_cond_wait(&p->nodes[w->node].wake, &p->lock);
+            p->nodes[w->node].idle--;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/**
+ * This function creates a pool of nthreads worker threads, or one per CPU
+ * the process may use if nthreads is 0. The NUMA topology is read from
+ * sysfs and the workers are shared between the nodes by their number of
+ * CPUs. Each worker is pinned to its node's CPUs and takes tasks from its
+ * node's queue, only taking them from other nodes, nearest first, when its
+ * own queue is empty.
+ */
+MYCUTILS_API pool* new_pool(unsigned nthreads)
+{
+    pthread_attr_t attr;    /* The attributes of a worker. */
+    pool* p;                /* The pool. */
+    unsigned cpus;          /* The CPUs of all the nodes. */
+    unsigned t;             /* Index of the current worker. */
+    unsigned c;             /* Workers given to the current node. */
+    int n;                  /* Index of the current node. */
+
+    p = (pool*) calloc(1, sizeof(pool));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->done, NULL);
+    pool_topology(p);
+    for (n = 0, cpus = 0; n < p->nnodes; n++)
+    {
+        pthread_cond_init(&p->nodes[n].wake, NULL);
+        cpus += CPU_COUNT(&p->nodes[n].cpus);
+    }
+    if (nthreads == 0)
+        nthreads = cpus;
+
+    /* Sharing the workers between the nodes by their CPUs, then handing out
+     * what's left over in turn. */
+    p->workers = (poolworker*) calloc(nthreads, sizeof(poolworker));
+    p->nworkers = nthreads;
+    for (n = 0, t = 0; n < p->nnodes; n++)
+        for (c = 0; c < nthreads * CPU_COUNT(&p->nodes[n].cpus) / cpus; c++)
+            p->workers[t++].node = n;
+    for (n = 0; t < nthreads; n = (n + 1) % p->nnodes)
+        p->workers[t++].node = n;
+
+    /* Starting the workers on their nodes' CPUs. */
+    for (t = 0; t < nthreads; t++)
+    {
+        p->workers[t].p = p;
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), 
+                                    &p->nodes[p->workers[t].node].cpus);
+        if ((errno = pthread_create(&p->workers[t].thread, &attr, 
+                                    pool_worker, &p->workers[t])) != 0)
+            fail("new_pool", "pthread_create");
+        pthread_attr_destroy(&attr);
+    }
+
+    return p;
+}
+
+/**
+ * This function creates the library's pool.
+ */
+static void lib_pool_init()
+{
+    lib_pool = new_pool(0);
+}
+
+/**
+ * This function returns the pool used by the library's parallel functions,
+ * creating it the first time. It has one worker per CPU and is never freed.
+ */
+MYCUTILS_API pool* shared_pool()
+{
+    pthread_once(&lib_pool_once, lib_pool_init);
+    return lib_pool;
+}
+
+/**
+ * This function returns the number of NUMA nodes the pool provided to it
+ * has workers on. Nodes are numbered from 0 up to this.
+ */
+MYCUTILS_API int pool_nodes(pool* p)
+{
+    return p->nnodes;
+}
+
+/**
+ * This function adds a task that calls fn with arg to the queue of the node
+ * provided, or spreads it over the nodes if node is -1. If g isn't NULL the
+ * task is counted in it.
+ */
+MYCUTILS_API void pool_submit(pool* p, taskgroup* g, int node, pool_fn fn,
+                              void* arg)
+{
+    poolnode* n;    /* The node queued on. */
+    pooltask* old;  /* The queue before it grew. */
+    size_t i;       /* Index of the current task. */
+    int k;          /* Index in the node's order. */
+
+    pthread_mutex_lock(&p->lock);
+    if (node < 0 || node >= p->nnodes)
+        node = p->next++ % p->nnodes;
+    n = &p->nodes[node];
+
+    /* Growing the ring, unwrapping it as it is copied. */
+    if (n->count == n->cap)
+    {
+        old = n->tasks;
+        n->tasks = (pooltask*) malloc(sizeof(pooltask) * 
+                                      (n->cap ? n->cap * 2 : 64));
+        for (i = 0; i < n->count; i++)
+            n->tasks[i] = old[(n->head + i) % n->cap];
+        free(old);
+        n->cap = n->cap ? n->cap * 2 : 64;
+        n->head = 0;
+    }
+    n->tasks[(n->head + n->count++) % n->cap] = (pooltask) { fn, arg, g };
+    if (g)
+        g->pending++;
+
+    /* Waking a worker on the node, or the nearest other node's if all of
+     * this node's workers are busy. */
+    if (n->idle > 0)
+        pthread_cond_signal(&n->wake);
+    else
+        for (k = 0; k < p->nnodes - 1; k++)
+            if (p->nodes[n->order[k]].idle > 0)
+            {
+                pthread_cond_signal(&p->nodes[n->order[k]].wake);
+                break;
+            }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ * This function adds a task like pool_submit(), on the node whose memory
+ * holds the page at addr, so a task working on part of a large buffer or
+ * mapped file runs next to it.
+ */
+MYCUTILS_API void pool_submit_at(pool* p, taskgroup* g, const void* addr,
+                                 pool_fn fn, void* arg)
+{
+    void* page;     /* The page holding addr. */
+    int status;     /* The node of the page. */
+    int node;       /* The pool's node of the page. */
+
+    node = -1;
+#ifdef SYS_move_pages
+    /* Asking the kernel where the page is, which fails for pages that
+     * aren't in memory yet. */
+    page = (void*) ((uintptr_t) addr & ~(uintptr_t) (getpagesize() - 1));
+    if (p->nnodes > 1 && 
+        syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) == 0)
+        for (node = p->nnodes - 1; node >= 0; node--)
+            if (p->nodes[node].id == status)
+                break;
+#else
+    (void) page;
+    (void) status;
+    (void) addr;
+#endif
+    pool_submit(p, g, node, fn, arg);
+}
+
+/**
+ * This function returns once every task in the group provided to it has
+ * finished. While waiting, the calling thread runs tasks queued on its own
+ * node.
+ */
+MYCUTILS_API void pool_wait(pool* p, taskgroup* g)
+{
+    pooltask task;  /* The current task. */
+    int cpu;        /* The calling thread's CPU. */
+    int node;       /* The calling thread's node. */
+
+    /* Finding the caller's node. */
+    cpu = sched_getcpu();
+    for (node = p->nnodes - 1; node > 0; node--)
+        if (cpu >= 0 && CPU_ISSET(cpu, &p->nodes[node].cpus))
+            break;
+
+    pthread_mutex_lock(&p->lock);
+    while (g->pending > 0)
+    {
+        if (pool_take(p, node, false, &task))
+            pool_run(p, &task);
+        else
+            pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ * This function runs any tasks left in the pool provided to it, then stops
+ * its workers and frees it.
+ */
+MYCUTILS_API void free_pool(pool* p)
+{
+    unsigned t; /* Index of the current worker. */
+    int n;      /* Index of the current node. */
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    for (n = 0; n < p->nnodes; n++)
+        pthread_cond_broadcast(&p->nodes[n].wake);
+    pthread_mutex_unlock(&p->lock);
+    for (t = 0; t < p->nworkers; t++)
+        pthread_join(p->workers[t].thread, NULL);
+
+    for (n = 0; n < p->nnodes; n++)
+    {
+        pthread_cond_destroy(&p->nodes[n].wake);
+        free(p->nodes[n].tasks);
+    }
+    pthread_cond_destroy(&p->done);
+    pthread_mutex_destroy(&p->lock);
+    free(p->workers);
+    free(p);
+}
+
+/**
+ * This function maps size bytes of memory on the node of the pool provided,
+ * using huge pages for large sizes as big_alloc() does. The memory is bound
+ * to the node with mbind() and prefaulted, or if that isn't possible, its
+ * pages are touched from the node's CPUs so the kernel places them there.
+ * It returns NULL if the memory can't be mapped.
+ */
+MYCUTILS_API void* node_alloc(pool* p, int node, size_t size)
+{
+    unsigned long mask[POOL_NODE_BITS / 64];    /* The node as a mask. */
+    cpu_set_t old;      /* The calling thread's CPUs. */
+    char* mem;          /* The memory. */
+    size_t pagesize;    /* The size of the pages backing it. */
+
+    if ((mem = big_map(size, &pagesize)) == NULL)
+        return NULL;
+    __atomic_store_n(&big_last_page, pagesize, __ATOMIC_RELAXED);
+    if (node < 0 || node >= p->nnodes || p->nnodes == 1)
+    {
+        big_prefault(mem, big_length(size));
+        return mem;
+    }
+
+    /* Preferring the node for the memory's pages. */
+    memset(mask, 0, sizeof(mask));
+    mask[p->nodes[node].id / (8 * sizeof(long))] |= 
+        1UL << (p->nodes[node].id % (8 * sizeof(long)));
+#ifdef SYS_mbind
+    if (syscall(SYS_mbind, mem, big_length(size), POOL_MPOL_PREFERRED, mask, 
+                POOL_NODE_BITS, 0) == 0)
+    {
+        big_prefault(mem, big_length(size));
+        return mem;
+    }
+#endif
+
+    /* Otherwise faulting the pages in from one of the node's CPUs, since
+     * pages are placed on the node of the CPU that first touches them. */
+    if (pthread_getaffinity_np(pthread_self(), sizeof(old), &old) == 0 &&
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), 
+                               &p->nodes[node].cpus) == 0)
+    {
+        big_prefault(mem, big_length(size));
+        pthread_setaffinity_np(pthread_self(), sizeof(old), &old);
+    }
+    return mem;
+}
+
+/**
+ * This function frees memory from node_alloc() of the size provided.
+ */
+MYCUTILS_API void node_free(void* mem, size_t size)
+{
+    big_free(mem, size);
+}
+
+/********************************** CSV **************************************/
+
+/**
+ * This is the number of bytes indexed at a time by a CSV parsing thread.
+ */
+#define CSV_WINDOW (64 * 1024)
+
+/**
+ * Each CSV parsing thread is given at least this many bytes.
+ */
+#define CSV_MIN_CHUNK (1024 * 1024)
+
+/**
+ * This is one CSV parsing thread's share of the data.
+ */
+typedef struct {
+    const char* data;   /* All of the data. */
+    size_t len;         /* The length of all of the data. */
+    size_t start;       /* The start of this thread's chunk. */
+    size_t end;         /* The end of this thread's chunk. */
+    char delim;         /* The field delimiter. */
+    bool inquote;       /* Whether the chunk starts inside quotes. */
+    uint64_t quotes;    /* The number of quotes in the chunk. */
+    csv_cb cb;          /* The row callback. */
+    void* arg;          /* The row callback's argument. */
+    size_t rows;        /* The number of rows this thread parsed. */
+} csvjob;
+
+/**
+ * This function returns a mask with each bit set if an odd number of bits
+ * at or below it are set in x. Applied to a mask of quotes, it gives the
+ * bytes that are inside quotes.
+ */
+static inline uint64_t prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/**
+ * This function finds the quotes, and the delimiters and newlines, in the
+ * 64 bytes at p, storing a bit for each byte in the masks provided.
+ */
+static inline void csv_masks(const char* p, char delim, 
+                             uint64_t* quotes, uint64_t* seps)
+{
+#ifdef __SSE2__
+    const __m128i QUOTE = _mm_set1_epi8('"');
+    const __m128i DELIM = _mm_set1_epi8(delim);
+    const __m128i NL = _mm_set1_epi8('\n');
+    __m128i v;      /* Sixteen of the bytes. */
+#endif
+    int i;          /* Index of the current byte or sixteen bytes. */
+
+    *quotes = 0;
+    *seps = 0;
+#ifdef __SSE2__
+    if (cpu_sse2)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            v = _mm_loadu_si128((const __m128i*) (p + i * 16));
+            *quotes |= (uint64_t) (uint16_t) 
+                       _mm_movemask_epi8(_mm_cmpeq_epi8(v, QUOTE)) 
+                       << (i * 16);
+            *seps |= (uint64_t) (uint16_t) 
+                     _mm_movemask_epi8(_mm_or_si128(
+                            _mm_cmpeq_epi8(v, DELIM), _mm_cmpeq_epi8(v, NL))) 
+                     << (i * 16);
+        }
+        return;
+    }
+#endif
+    for (i = 0; i < 64; i++)
+    {
+        *quotes |= (uint64_t) (p[i] == '"') << i;
+        *seps |= (uint64_t) (p[i] == delim || p[i] == '\n') << i;
+    }
+}
+
+/**
+ * This function stores the offsets of the delimiters and newlines that are
+ * outside quotes in the len bytes at p in idx, and returns how many there
+ * are. inquote holds whether p starts inside quotes and is updated to
+ * whether the bytes after p + len do.
+ */
+static size_t csv_index(const char* p, size_t len, char delim, bool* inquote,
+                        uint32_t* idx)
+{
+    char tail[64];      /* The last partial block, padded. */
+    const char* block;  /* The current block. */
+    uint64_t quotes;    /* The quotes in the block. */
+    uint64_t seps;      /* The delimiters and newlines in the block. */
+    uint64_t inside;    /* The bytes in the block that are inside quotes. */
+    uint64_t carry;     /* All ones if the block starts inside quotes. */
+    size_t n;           /* The number of offsets found. */
+    size_t b;           /* The offset of the current block. */
+
+    cpu_level();
+    n = 0;
+    carry = *inquote ? ~(uint64_t) 0 : 0;
+    for (b = 0; b < len; b += 64)
+    {
+        /* Padding the last block with bytes that mean nothing. */
+        block = p + b;
+        if (len - b < 64)
+        {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, len - b);
+            block = tail;
+        }
+
+        /* Finding the separators that aren't inside quotes. Escaped quotes
+         * toggle the state twice, so they need no special handling. */
+        csv_masks(block, delim, &quotes, &seps);
+        inside = prefix_xor(quotes) ^ carry;
+        carry = (uint64_t) ((int64_t) inside >> 63);
+        seps &= ~inside;
+
+        /* Storing their offsets. */
+        while (seps)
+        {
+            idx[n++] = b + __builtin_ctzll(seps);
+            seps &= seps - 1;
+        }
+    }
+
+    *inquote = carry != 0;
+    return n;
+}
+
+/**
+ * This function adds the field between p and end to the row provided to it,
+ * growing the row if needed.
+ */
+static void csv_push(csvfield** row, size_t* n, size_t* cap, 
+                     const char* p, const char* end, bool last)
+{
+    csvfield* f;    /* The field. */
+
+    /* Growing the row. */
+    if (*n == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 16;
+        *row = (csvfield*) realloc(*row, sizeof(csvfield) * *cap);
+    }
+
+    /* Dropping the carriage return of a CRLF line ending. */
+    if (last && end > p && end[-1] == '\r')
+        end--;
+
+    /* Removing the quotes around a quoted field. */
+    f = &(*row)[(*n)++];
+    f->quoted = end - p >= 2 && *p == '"' && end[-1] == '"';
+    f->ptr = f->quoted ? p + 1 : p;
+    f->len = f->quoted ? end - p - 2 : end - p;
+}
+
+/**
+ * This function calls the callback for the row provided to it unless it is
+ * a blank line.
+ */
+static void csv_emit(csvjob* job, csvfield* row, size_t n)
+{
+    if (n == 1 && row[0].len == 0 && !row[0].quoted)
+        return;
+    job->cb(row, n, job->arg);
+    job->rows++;
+}
+
+/**
+ * This function counts the quotes in a CSV parsing thread's chunk.
+ */
+static void csv_count(void* arg)
+{
+    csvjob* job;        /* The thread's share of the data. */
+    char tail[64];      /* The last partial block, padded. */
+    const char* block;  /* The current block. */
+    uint64_t quotes;    /* The quotes in the block. */
+    uint64_t seps;      /* The separators in the block. */
+    size_t b;           /* The offset of the current block. */
+
+    job = (csvjob*) arg;
+    job->quotes = 0;
+    for (b = job->start; b < job->end; b += 64)
+    {
+        block = job->data + b;
+        if (job->end - b < 64)
+        {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, job->end - b);
+            block = tail;
+        }
+        csv_masks(block, job->delim, &quotes, &seps);
+        job->quotes += __builtin_popcountll(quotes);
+    }
+}
+
+/**
+ * This function parses the rows that belong to a CSV parsing thread. They
+ * are the rows that start after the first newline at or after the start of
+ * its chunk, up to and including the row ending at the first newline at or
+ * after the end of its chunk. The first chunk starts with the first row.
+ */
+static void csv_parse(void* arg)
+{
+    csvjob* job;        /* The thread's share of the data. */
+    uint32_t* idx;      /* The separators in the current window. */
+    csvfield* row;      /* The fields of the current row. */
+    size_t nfields;     /* The number of fields in the row. */
+    size_t cap;         /* The allocated size of the row. */
+    size_t pos;         /* The offset of the current window. */
+    size_t wlen;        /* The length of the current window. */
+    size_t n;           /* The number of separators in the window. */
+    size_t k;           /* Index of the current separator. */
+    size_t at;          /* The offset of the current separator. */
+    size_t fstart;      /* The offset of the start of the current field. */
+    bool skipping;      /* Whether the previous thread's row is being skipped. */
+    bool inquote;       /* Whether the next window starts inside quotes. */
+
+    job = (csvjob*) arg;
+    idx = (uint32_t*) malloc(sizeof(uint32_t) * CSV_WINDOW);
+    row = NULL;
+    nfields = cap = 0;
+    skipping = job->start != 0;
+    inquote = job->inquote;
+    fstart = job->start;
+
+    for (pos = job->start; pos < job->len; pos += wlen)
+    {
+        /* Indexing the next window. */
+        wlen = job->len - pos < CSV_WINDOW ? job->len - pos : CSV_WINDOW;
+        n = csv_index(job->data + pos, wlen, job->delim, &inquote, idx);
+
+        for (k = 0; k < n; k++)
+        {
+            at = pos + idx[k];
+
+            /* Skipping to the end of the row the previous thread owns. */
+            if (skipping)
+            {
+                if (job->data[at] != '\n')
+                    continue;
+                if (at >= job->end)
+                    goto done;
+                skipping = false;
+                fstart = at + 1;
+                continue;
+            }
+
+            /* Adding the field that ends here. */
+            csv_push(&row, &nfields, &cap, job->data + fstart, 
+                     job->data + at, job->data[at] == '\n');
+            fstart = at + 1;
+
+            /* Passing on the row if this is its end. */
+            if (job->data[at] == '\n')
+            {
+                csv_emit(job, row, nfields);
+                nfields = 0;
+                if (at >= job->end)
+                    goto done;
+            }
+        }
+    }
+
+    /* Passing on a last row that has no newline. */
+    if (!skipping && fstart < job->len)
+    {
+        csv_push(&row, &nfields, &cap, job->data + fstart, 
+                 job->data + job->len, true);
+        csv_emit(job, row, nfields);
+    }
+
+done:
+    free(idx);
+    free(row);
+}
+
+/**
+ * This function parses len bytes of CSV (or TSV, or any single-byte
+ * delimiter) data and calls cb for each non-empty row. It finds delimiters,
+ * quotes and newlines 64 bytes at a time with bitmasks, so no per-field
+ * work or allocation is done. The data is split into nthreads chunks, or
+ * one per CPU if nthreads is 0, which are parsed by the shared pool, each
+ * on the NUMA node holding it. It returns the number of rows parsed.
+ */
+MYCUTILS_API size_t parsecsv(const char* data, size_t len, char delim,
+                             unsigned nthreads, csv_cb cb, void* arg)
+{
+    csvjob* jobs;       /* Each thread's share of the data. */
+    taskgroup group;    /* The tasks running the jobs. */
+    size_t chunk;       /* The size of each share. */
+    size_t rows;        /* The number of rows parsed. */
+    bool inquote;       /* Whether the current chunk starts inside quotes. */
+    unsigned t;         /* Index of the current thread. */
+
+    /* Choosing how many threads to use, giving each a worthwhile share. */
+    if (nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > len / CSV_MIN_CHUNK)
+        nthreads = len / CSV_MIN_CHUNK;
+    if (nthreads == 0)
+        nthreads = 1;
+
+    /* Splitting the data into 64 byte aligned chunks. */
+    jobs = (csvjob*) calloc(nthreads, sizeof(csvjob));
+    chunk = (len / nthreads + 63) & ~(size_t) 63;
+    for (t = 0; t < nthreads; t++)
+    {
+        jobs[t].data = data;
+        jobs[t].len = len;
+        jobs[t].start = t * chunk < len ? t * chunk : len;
+        jobs[t].end = (t + 1) * chunk < len ? (t + 1) * chunk : len;
+        jobs[t].delim = delim;
+        jobs[t].cb = cb;
+        jobs[t].arg = arg;
+    }
+    jobs[nthreads - 1].end = len;
+
+    /* Parsing a single chunk here. It starts outside quotes, so there is
+     * nothing to count, and the pool isn't needed. */
+    if (nthreads == 1)
+    {
+        csv_parse(&jobs[0]);
+        rows = jobs[0].rows;
+        free(jobs);
+        return rows;
+    }
+
+    /* Counting each chunk's quotes, so every chunk knows whether it starts
+     * inside quotes. Each chunk is counted on the NUMA node holding it. */
+    group.pending = 0;
+    for (t = 1; t < nthreads; t++)
+        pool_submit_at(shared_pool(), &group, data + jobs[t].start, 
+                       csv_count, &jobs[t]);
+    csv_count(&jobs[0]);
+    pool_wait(shared_pool(), &group);
+    inquote = false;
+    for (t = 0; t < nthreads; t++)
+    {
+        jobs[t].inquote = inquote;
+        inquote ^= jobs[t].quotes & 1;
+    }
+
+    /* Parsing the chunks. */
+    for (t = 1; t < nthreads; t++)
+        pool_submit_at(shared_pool(), &group, data + jobs[t].start, 
+                       csv_parse, &jobs[t]);
+    csv_parse(&jobs[0]);
+    pool_wait(shared_pool(), &group);
+
+    /* Totalling the rows. */
+    rows = 0;
+    for (t = 0; t < nthreads; t++)
+        rows += jobs[t].rows;
+    free(jobs);
+
+    return rows;
+}
+
+/**
+ * This function maps the file that has a name that matches fname and parses
+ * it with parsecsv(). If there is an error it will be printed on stderr and
+ * the program is exited.
+ */
+MYCUTILS_API size_t parsecsv_fs(char* fname, char delim, unsigned nthreads,
+                                csv_cb cb, void* arg)
+{
+    struct stat st;     /* The status of the file. */
+    void* map;          /* The mapping of the file. */
+    size_t rows;        /* The number of rows parsed. */
+    int fd;             /* The file's descriptor. */
+
+    /* Opening the file. */
+    if ((fd = open(fname, O_RDONLY | O_CLOEXEC)) == -1 || 
+        fstat(fd, &st) == -1)
+        fail("parsecsv_fs", fname);
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    /* Mapping the file. */
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        fail("parsecsv_fs", fname);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    /* Parsing the file. */
+    rows = parsecsv((const char*) map, st.st_size, delim, nthreads, cb, arg);
+
+    munmap(map, st.st_size);
+    return rows;
+}
+
+/****************************** JSON Lines ***********************************/
+
+/**
+ * This is a writer of JSON Lines records.
+ */
+struct jsonw {
+    FILE* fs;       /* The stream written to. */
+    char* buf;      /* The buffered output. */
+    size_t len;     /* The number of bytes buffered. */
+    bool first;     /* Whether the next field is the first in the record. */
+};
+
+/**
+ * This is the longest piece of a string escaped at once. It is small enough
+ * that its escaped form always fits in the buffer.
+ */
+#define JSONW_PIECE (JSONW_BUF_SIZE / 8)
+
+/**
+ * These are the digit pairs from 00 to 99, so integers are formatted two
+ * digits at a time.
+ */
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+/**
+ * This function creates a JSON Lines writer that writes to the file stream
+ * provided to it.
+ */
+MYCUTILS_API jsonw* openjw(FILE* fs)
+{
+    jsonw* w;   /* The writer. */
+
+    w = (jsonw*) malloc(sizeof(jsonw));
+    w->fs = fs;
+    w->buf = (char*) malloc(JSONW_BUF_SIZE);
+    w->len = 0;
+    w->first = true;
+    return w;
+}
+
+/**
+ * This function writes out anything buffered by the JSON Lines writer.
+ */
+MYCUTILS_API void flushjw(jsonw* w)
+{
+    if (w->len > 0 && fwrite(w->buf, 1, w->len, w->fs) != w->len)
+        fail("flushjw", "stream");
+    w->len = 0;
+}
+
+/**
+ * This function makes sure there is room for n more bytes in the buffer.
+ */
+static inline void jwroom(jsonw* w, size_t n)
+{
+    if (JSONW_BUF_SIZE - w->len < n)
+        flushjw(w);
+}
+
+/**
+ * This function returns the offset of the first byte in the len bytes at p
+ * that must be escaped in a JSON string, or len if there isn't one.
+ */
+static inline size_t jwscan(const char* p, size_t len)
+{
+#ifdef __SSE2__
+    const __m128i QUOTE = _mm_set1_epi8('"');
+    const __m128i BSLASH = _mm_set1_epi8('\\');
+    const __m128i CTRL = _mm_set1_epi8(0x1F);
+    __m128i v;  /* Sixteen of the bytes. */
+    int mask;   /* The bytes that must be escaped. */
+#endif
+    size_t i;   /* Index of the current byte. */
+
+    i = 0;
+#ifdef __SSE2__
+    /* Checking sixteen bytes at a time. A byte is a control character if it
+     * is unchanged by taking the unsigned minimum with 0x1F. */
+    cpu_level();
+    for (; cpu_sse2 && i + 16 <= len; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*) (p + i));
+        mask = _mm_movemask_epi8(
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, QUOTE), 
+                                          _mm_cmpeq_epi8(v, BSLASH)), 
+                             _mm_cmpeq_epi8(_mm_min_epu8(v, CTRL), v)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    /* Checking the remaining bytes one at a time. */
+    for (; i < len; i++)
+        if (p[i] == '"' || p[i] == '\\' || (unsigned char) p[i] < 0x20)
+            return i;
+    return len;
+}
+
+/**
+ * This function writes the len bytes at p as the contents of a JSON string,
+ * escaping what needs to be. Runs of bytes that don't need escaping are
+ * copied whole.
+ */
+static void jwescape(jsonw* w, const char* p, size_t len)
+{
+    const char HEX[] = "0123456789abcdef";
+    size_t piece;   /* The length of the current piece. */
+    size_t run;     /* The length of a run that needs no escaping. */
+    char* out;      /* Where the next byte is written. */
+    unsigned char c;/* A byte that needs escaping. */
+
+    while (len > 0)
+    {
+        /* Making room for the piece even if every byte is escaped. */
+        piece = len < JSONW_PIECE ? len : JSONW_PIECE;
+        jwroom(w, piece * 6);
+        out = w->buf + w->len;
+
+        while (piece > 0)
+        {
+            /* Copying the run of plain bytes. */
+            run = jwscan(p, piece);
+            memcpy(out, p, run);
+            out += run;
+            p += run;
+            len -= run;
+            piece -= run;
+            if (piece == 0)
+                break;
+
+            /* Escaping the byte that ended the run. */
+            c = (unsigned char) *p++;
+            len--;
+            piece--;
+            *out++ = '\\';
+            switch (c)
+            {
+                case '"'  : *out++ = '"'; break;
+                case '\\' : *out++ = '\\'; break;
+                case '\n' : *out++ = 'n'; break;
+                case '\r' : *out++ = 'r'; break;
+                case '\t' : *out++ = 't'; break;
+                case '\b' : *out++ = 'b'; break;
+                case '\f' : *out++ = 'f'; break;
+                default:
+                    memcpy(out, "u00", 3);
+                    out[3] = HEX[c >> 4];
+                    out[4] = HEX[c & 0xF];
+                    out += 5;
+            }
+        }
+
+        w->len = out - w->buf;
+    }
+}
+
+/**
+ * This function writes the separator before a field and the field's key.
+ */
+static void jwkey(jsonw* w, char* key)
+{
+    jwroom(w, 2);
+    if (!w->first)
+        w->buf[w->len++] = ',';
+    w->first = false;
+    w->buf[w->len++] = '"';
+    jwescape(w, key, strlen(key));
+    jwroom(w, 2);
+    w->buf[w->len++] = '"';
+    w->buf[w->len++] = ':';
+}
+
+/**
+ * This function writes the number provided to it in decimal, two digits at
+ * a time.
+ */
+static void jwdigits(jsonw* w, uint64_t v)
+{
+    char tmp[20];   /* The digits, filled from the end. */
+    char* p;        /* The first digit. */
+
+    p = tmp + sizeof(tmp);
+    while (v >= 100)
+    {
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10)
+    {
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + v * 2, 2);
+    }
+    else
+        *--p = '0' + v;
+
+    jwroom(w, sizeof(tmp));
+    memcpy(w->buf + w->len, p, tmp + sizeof(tmp) - p);
+    w->len += tmp + sizeof(tmp) - p;
+}
+
+/**
+ * This function writes the literal provided to it.
+ */
+static void jwlit(jsonw* w, const char* lit, size_t len)
+{
+    jwroom(w, len);
+    memcpy(w->buf + w->len, lit, len);
+    w->len += len;
+}
+
+/**
+ * This function starts a record.
+ */
+MYCUTILS_API void jwbegin(jsonw* w)
+{
+    jwlit(w, "{", 1);
+    w->first = true;
+}
+
+/**
+ * This function adds a string field of len bytes to the current record,
+ * escaping it as JSON requires.
+ */
+MYCUTILS_API void jwstr(jsonw* w, char* key, const char* val, size_t len)
+{
+    jwkey(w, key);
+    jwlit(w, "\"", 1);
+    jwescape(w, val, len);
+    jwlit(w, "\"", 1);
+}
+
+/**
+ * This function adds a null-terminated string field to the current record.
+ */
+MYCUTILS_API void jwcstr(jsonw* w, char* key, char* val)
+{
+    jwstr(w, key, val, strlen(val));
+}
+
+/**
+ * This function adds a signed integer field to the current record.
+ */
+MYCUTILS_API void jwint(jsonw* w, char* key, int64_t val)
+{
+    jwkey(w, key);
+    if (val < 0)
+    {
+        jwlit(w, "-", 1);
+        jwdigits(w, -(uint64_t) val);
+    }
+    else
+        jwdigits(w, val);
+}
+
+/**
+ * This function adds an unsigned integer field to the current record.
+ */
+MYCUTILS_API void jwuint(jsonw* w, char* key, uint64_t val)
+{
+    jwkey(w, key);
+    jwdigits(w, val);
+}
+
+/**
+ * The C locale, which numbers are formatted in so the decimal point doesn't
+ * depend on the program's locale. It is made once.
+ */
+static locale_t c_locale;
+static pthread_once_t c_locale_once = PTHREAD_ONCE_INIT;
+
+/**
+ * This function makes the C locale.
+ */
+static void c_locale_init()
+{
+    c_locale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+}
+
+/**
+ * This function adds a floating point field to the current record, with the
+ * fewest digits that read back exactly and always with '.' as the decimal
+ * point. NaNs and infinities are written as null.
+ */
+MYCUTILS_API void jwdouble(jsonw* w, char* key, double val)
+{
+    locale_t old;   /* The thread's locale. */
+    char* dot;      /* A decimal point that isn't '.'. */
+    int n;          /* The length of the formatted value. */
+
+    jwkey(w, key);
+
+    /* Writing values JSON can't represent as null. */
+    if (!isfinite(val))
+    {
+        jwlit(w, "null", 4);
+        return;
+    }
+
+    /* Writing integral values with the integer formatter. The range is
+     * checked first since converting a value out of range to an integer is
+     * undefined. */
+    if (val > -1e15 && val < 1e15 && val == (double) (int64_t) val)
+    {
+        if (signbit(val))
+        {
+            jwlit(w, "-", 1);
+            jwdigits(w, -(int64_t) val);
+        }
+        else
+            jwdigits(w, (int64_t) val);
+        return;
+    }
+
+    /* Writing other values in the C locale, with 15 digits if they read
+     * back exactly and 17, which always do, if they don't. */
+    jwroom(w, 32);
+    pthread_once(&c_locale_once, c_locale_init);
+    old = c_locale ? uselocale(c_locale) : (locale_t) 0;
+    n = snprintf(w->buf + w->len, 32, "%.15g", val);
+    if (strtod(w->buf + w->len, NULL) != val)
+        n = snprintf(w->buf + w->len, 32, "%.17g", val);
+    if (old)
+        uselocale(old);
+
+    /* Making sure of the decimal point if there was no C locale. */
+    if (!old && (dot = memchr(w->buf + w->len, ',', n)) != NULL)
+        *dot = '.';
+    w->len += n;
+}
+
+/**
+ * This function adds a boolean field to the current record.
+ */
+MYCUTILS_API void jwbool(jsonw* w, char* key, bool val)
+{
+    jwkey(w, key);
+    if (val)
+        jwlit(w, "true", 4);
+    else
+        jwlit(w, "false", 5);
+}
+
+/**
+ * This function adds a null field to the current record.
+ */
+MYCUTILS_API void jwnull(jsonw* w, char* key)
+{
+    jwkey(w, key);
+    jwlit(w, "null", 4);
+}
+
+/**
+ * This function ends the current record.
+ */
+MYCUTILS_API void jwend(jsonw* w)
+{
+    jwlit(w, "}\n", 2);
+}
+
+/**
+ * This function flushes and frees the JSON Lines writer. The file stream is
+ * left open.
+ */
+MYCUTILS_API void closejw(jsonw* w)
+{
+    flushjw(w);
+    free(w->buf);
+    free(w);
+}
+
+/******************************** Sorting ************************************/
+
+/**
+ * This is the size of the stdio buffers used to write sorted runs and
+ * output.
+ */
+#define SORT_IO_BUF (1024 * 1024)
+
+/**
+ * This is one line being sorted. The first eight bytes of its key are packed
+ * into prefix so most comparisons are a single integer compare.
+ */
+typedef struct {
+    const char* line;   /* The line. */
+    size_t len;         /* The length of the line. */
+    size_t koff;        /* The offset of the key in the line. */
+    size_t klen;        /* The length of the key. */
+    uint64_t prefix;    /* The first bytes of the key, big-endian. */
+} sortent;
+
+/**
+ * This is a range of lines in the input that is sorted in memory as one
+ * run.
+ */
+typedef struct {
+    const char* start;  /* The first line. */
+    const char* end;    /* The end of the last line. */
+    size_t lines;       /* The number of lines. */
+    char* tmpname;      /* The file the sorted run is written to. */
+} sortrun;
+
+/**
+ * This is the state shared by the threads sorting runs.
+ */
+typedef struct {
+    sortrun* runs;          /* The runs. */
+    size_t nruns;           /* The number of runs. */
+    size_t next;            /* The next run to be sorted. */
+    pthread_mutex_t lock;   /* Protects next. */
+    sortkey_cb key;         /* The key callback. */
+} sortjob;
+
+/**
+ * This is one of the runs being merged.
+ */
+typedef struct {
+    reader* r;          /* The run's reader. */
+    sortent e;          /* The run's current line. */
+    bool done;          /* Whether the run has no more lines. */
+} sortsrc;
+
+/**
+ * This function fills in the line and key of the sort entry provided to it.
+ */
+static void sort_setkey(sortent* e, const char* line, size_t len, 
+                        sortkey_cb key)
+{
+    const char* k;  /* The key. */
+    size_t klen;    /* The length of the key. */
+    size_t b;       /* Index of the current byte of the prefix. */
+
+    /* Finding the key. */
+    k = line;
+    klen = len;
+    if (key != NULL)
+        key(line, len, &k, &klen);
+
+    e->line = line;
+    e->len = len;
+    e->koff = k - line;
+    e->klen = klen;
+
+    /* Packing the start of the key so it compares as an integer. */
+    e->prefix = 0;
+    for (b = 0; b < 8; b++)
+        e->prefix = (e->prefix << 8) | (b < klen ? (unsigned char) k[b] : 0);
+}
+
+/**
+ * This function compares the keys of two sort entries, for qsort().
+ */
+static int sort_cmp(const void* a, const void* b)
+{
+    const sortent* x;   /* The first entry. */
+    const sortent* y;   /* The second entry. */
+    size_t n;           /* The length of the shorter key. */
+    int c;              /* The result of comparing the common part. */
+
+    x = (const sortent*) a;
+    y = (const sortent*) b;
+    if (x->prefix != y->prefix)
+        return x->prefix < y->prefix ? -1 : 1;
+    n = x->klen < y->klen ? x->klen : y->klen;
+    if ((c = memcmp(x->line + x->koff, y->line + y->koff, n)) != 0)
+        return c;
+    return (x->klen > y->klen) - (x->klen < y->klen);
+}
+
+/**
+ * This function sorts n entries. They are radix sorted on their key
+ * prefixes a byte at a time, skipping bytes that every key shares, then
+ * entries whose prefixes tie are sorted by their whole keys.
+ */
+static void sort_ents(sortent* ents, size_t n)
+{
+    sortent* buf[2];    /* The two buffers the radix passes move between. */
+    size_t counts[256]; /* The number of entries with each byte value. */
+    size_t sum;         /* The running total of the counts. */
+    size_t c;           /* The current count. */
+    size_t i;           /* Index of the current entry. */
+    size_t j;           /* Index of the end of a run of equal prefixes. */
+    int cur;            /* The buffer holding the entries. */
+    int shift;          /* The shift of the current prefix byte. */
+
+    if (n < 2)
+        return;
+
+    buf[0] = ents;
+    buf[1] = (sortent*) malloc(sizeof(sortent) * n);
+    cur = 0;
+    for (shift = 0; shift < 64; shift += 8)
+    {
+        /* Counting each byte value. */
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < n; i++)
+            counts[(buf[cur][i].prefix >> shift) & 0xFF]++;
+
+        /* Skipping bytes that are the same in every key. */
+        if (counts[(buf[cur][0].prefix >> shift) & 0xFF] == n)
+            continue;
+
+        /* Moving the entries to the other buffer in order of this byte. */
+        for (sum = 0, c = 0; c < 256; c++)
+        {
+            i = counts[c];
+            counts[c] = sum;
+            sum += i;
+        }
+        for (i = 0; i < n; i++)
+            buf[!cur][counts[(buf[cur][i].prefix >> shift) & 0xFF]++] = 
+                buf[cur][i];
+        cur = !cur;
+    }
+
+    /* Moving the entries back if they ended up in the other buffer. */
+    if (cur == 1)
+        memcpy(ents, buf[1], sizeof(sortent) * n);
+    free(buf[1]);
+
+    /* Sorting ties by their whole keys. */
+    for (i = 0; i < n; i = j)
+    {
+        for (j = i + 1; j < n && ents[j].prefix == ents[i].prefix; j++)
+            ;
+        if (j - i > 1)
+            qsort(ents + i, j - i, sizeof(sortent), sort_cmp);
+    }
+}
+
+/**
+ * This function writes the line of each of the n entries provided to it,
+ * followed by a newline, to the file stream provided to it.
+ */
+static void sort_write(FILE* fs, sortent* ents, size_t n, char* fname)
+{
+    size_t i;   /* Index of the current entry. */
+
+    for (i = 0; i < n; i++)
+        if (fwrite(ents[i].line, 1, ents[i].len, fs) != ents[i].len ||
+            putc_unlocked('\n', fs) == EOF)
+            fail("sortfs", fname);
+}
+
+/**
+ * This function is run by each thread sorting runs. It takes runs until
+ * there are none left, sorting each one and writing it to its temporary
+ * file.
+ */
+static void sort_runs(void* arg)
+{
+    sortjob* job;       /* The shared state. */
+    sortrun* run;       /* The current run. */
+    sortent* ents;      /* The run's lines. */
+    const char* p;      /* The current line. */
+    const char* nl;     /* The end of the current line. */
+    FILE* fs;           /* The run's temporary file. */
+    size_t i;           /* Index of the current line. */
+    size_t r;           /* Index of the current run. */
+    int fd;             /* The temporary file's descriptor. */
+
+    job = (sortjob*) arg;
+    for (;;)
+    {
+        /* Taking the next run. */
+        pthread_mutex_lock(&job->lock);
+        r = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (r >= job->nruns)
+            return;
+        run = &job->runs[r];
+
+        /* Finding the run's lines and keys. */
+        ents = (sortent*) malloc(sizeof(sortent) * (run->lines ? run->lines : 1));
+        for (p = run->start, i = 0; i < run->lines; p = nl + 1, i++)
+        {
+            if ((nl = memchr(p, '\n', run->end - p)) == NULL)
+                nl = run->end;
+            sort_setkey(&ents[i], p, nl - p, job->key);
+        }
+
+        /* Sorting the run. */
+        sort_ents(ents, run->lines);
+
+        /* Writing the run to its temporary file. */
+        if ((fd = mkstemp(run->tmpname)) == -1 || 
+            (fs = fdopen(fd, "w")) == NULL)
+            fail("sortfs", run->tmpname);
+        setvbuf(fs, NULL, _IOFBF, SORT_IO_BUF);
+        sort_write(fs, ents, run->lines, run->tmpname);
+        closefs(fs);
+
+        free(ents);
+    }
+}
+
+/**
+ * This function returns true if the current line of merge source a sorts
+ * before that of b. Finished sources sort after everything, and ties go to
+ * the earlier run.
+ */
+static inline bool sort_less(sortsrc* srcs, size_t k, size_t a, size_t b)
+{
+    int c;  /* The result of comparing the keys. */
+
+    /* Treating k as a source that is smaller than every other. */
+    if (a == k || b == k)
+        return a == k && b != k;
+    if (srcs[a].done || srcs[b].done)
+        return !srcs[a].done || (srcs[b].done && a < b);
+    c = sort_cmp(&srcs[a].e, &srcs[b].e);
+    return c < 0 || (c == 0 && a < b);
+}
+
+/**
+ * This function replays the loser tree from leaf s up to the root after
+ * merge source s has moved to its next line. Each node keeps the loser of
+ * the match played there and the overall winner ends up in tree[0].
+ */
+static void sort_adjust(size_t* tree, sortsrc* srcs, size_t k, size_t s)
+{
+    size_t t;       /* The current node. */
+    size_t swap;    /* Used to swap the winner and a loser. */
+
+    for (t = (s + k) / 2; t > 0; t /= 2)
+    {
+        if (sort_less(srcs, k, tree[t], s))
+        {
+            swap = s;
+            s = tree[t];
+            tree[t] = swap;
+        }
+    }
+    tree[0] = s;
+}
+
+/**
+ * This function moves merge source s to its next line.
+ */
+static void sort_advance(sortsrc* src, sortkey_cb key)
+{
+    const char* line;   /* The next line. */
+    size_t len;         /* The length of the line. */
+
+    if (!readrdl(src->r, &line, &len))
+        src->done = true;
+    else
+        sort_setkey(&src->e, line, len, key);
+}
+
+/**
+ * This function merges the k sorted runs provided to it into the file
+ * stream provided to it, using a loser tree so each line costs about
+ * log2(k) comparisons.
+ */
+static void sort_merge(sortrun* runs, size_t k, FILE* out, char* dst, 
+                       sortkey_cb key)
+{
+    sortsrc* srcs;  /* The runs being merged. */
+    size_t* tree;   /* The loser tree. */
+    size_t s;       /* Index of the current source. */
+
+    if (k == 0)
+        return;
+
+    /* Opening the runs at their first lines. */
+    srcs = (sortsrc*) calloc(k, sizeof(sortsrc));
+    for (s = 0; s < k; s++)
+    {
+        srcs[s].r = openrd(runs[s].tmpname, READ_SEQUENTIAL);
+        sort_advance(&srcs[s], key);
+    }
+
+    /* Building the tree by replaying every leaf against a tree full of
+     * sources that win every match. */
+    tree = (size_t*) malloc(sizeof(size_t) * k);
+    tree[0] = k;
+    for (s = 1; s < k; s++)
+        tree[s] = k;
+    for (s = k; s > 0; s--)
+        sort_adjust(tree, srcs, k, s - 1);
+
+    /* Writing the winner and replacing it with its run's next line until
+     * every run is finished. */
+    while (!srcs[s = tree[0]].done)
+    {
+        sort_write(out, &srcs[s].e, 1, dst);
+        sort_advance(&srcs[s], key);
+        sort_adjust(tree, srcs, k, s);
+    }
+
+    /* Cleaning up. */
+    for (s = 0; s < k; s++)
+        closerd(srcs[s].r);
+    free(srcs);
+    free(tree);
+}
+
+/**
+ * This function deletes the temporary files of the n runs provided to it.
+ */
+static void sort_remove(sortrun* runs, size_t n)
+{
+    size_t r;   /* Index of the current run. */
+
+    for (r = 0; r < n; r++)
+    {
+        unlink(runs[r].tmpname);
+        free(runs[r].tmpname);
+    }
+}
+
+/**
+ * This function sorts the lines of the file named src into the file named
+ * dst, which may be larger than memory. Lines are sorted by the bytes of
+ * the key that the key callback finds, or by the whole line if key is NULL.
+ * The file is split into runs that fit budget bytes of sorting memory,
+ * which are radix sorted by nthreads threads (one per CPU if 0) and spilled
+ * to temporary files next to dst, then merged, at most SORT_MERGE_WAYS at
+ * a time. Every output line ends with a newline. It returns the number of
+ * lines sorted. If there is an error it will be printed on stderr and the
+ * program is exited.
+ */
+MYCUTILS_API size_t sortfs(char* src, char* dst, size_t budget,
+                           unsigned nthreads, sortkey_cb key)
+{
+    sortjob job;        /* The state shared by the sorting threads. */
+    taskgroup group;    /* The sorting tasks. */
+    struct stat st;     /* The status of the input file. */
+    const char* data;   /* The mapped input file. */
+    const char* p;      /* The current line. */
+    const char* nl;     /* The end of the current line. */
+    size_t runmax;      /* The most memory one run may use. */
+    size_t runmem;      /* The memory the current run needs. */
+    size_t cap;         /* The allocated number of runs. */
+    size_t total;       /* The number of lines sorted. */
+    size_t r;           /* Index of the current run. */
+    size_t m;           /* Index of the current merged run. */
+    size_t n;           /* The number of runs merged into it. */
+    char* tmpname;      /* The file a merged run is written to. */
+    FILE* out;          /* The output file. */
+    unsigned t;         /* Index of the current thread. */
+    int fd;             /* The input file's descriptor. */
+
+    /* Mapping the input file. */
+    if ((fd = open(src, O_RDONLY | O_CLOEXEC)) == -1 || fstat(fd, &st) == -1)
+        fail("sortfs", src);
+    data = NULL;
+    if (st.st_size > 0 && 
+        (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) 
+        == MAP_FAILED)
+        fail("sortfs", src);
+    close(fd);
+    if (data != NULL)
+        madvise((void*) data, st.st_size, MADV_SEQUENTIAL);
+
+    /* Each thread sorts a run at once, so they share the budget. A run
+     * needs two entries per line for the radix passes. */
+    if (nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    runmax = budget / nthreads;
+
+    /* Splitting the input into runs that fit. */
+    memset(&job, 0, sizeof(job));
+    job.key = key;
+    pthread_mutex_init(&job.lock, NULL);
+    cap = 0;
+    total = 0;
+    runmem = 0;
+    for (p = data; p < data + st.st_size; p = nl + 1)
+    {
+        /* Starting a new run if there is none or the last one is full. */
+        if (job.nruns == 0 || runmem >= runmax)
+        {
+            if (job.nruns == cap)
+            {
+                cap = cap ? cap * 2 : 16;
+                job.runs = (sortrun*) realloc(job.runs, sizeof(sortrun) * cap);
+            }
+            job.runs[job.nruns].start = p;
+            job.runs[job.nruns].lines = 0;
+            strfmt(&job.runs[job.nruns].tmpname, "%s.runXXXXXX", dst);
+            job.nruns++;
+            runmem = 0;
+        }
+
+        /* Adding the line to the run. */
+        if ((nl = memchr(p, '\n', data + st.st_size - p)) == NULL)
+            nl = data + st.st_size;
+        job.runs[job.nruns - 1].end = nl;
+        job.runs[job.nruns - 1].lines++;
+        runmem += 2 * sizeof(sortent);
+        total++;
+    }
+
+    /* Sorting the runs. At most nthreads run at once, to keep within the
+     * budget. */
+    group.pending = 0;
+    for (t = 1; t < nthreads; t++)
+        pool_submit(shared_pool(), &group, -1, sort_runs, &job);
+    sort_runs(&job);
+    pool_wait(shared_pool(), &group);
+
+    /* The input is no longer needed once the runs are written. */
+    if (data != NULL)
+        munmap((void*) data, st.st_size);
+
+    /* Merging groups of runs into longer runs until they can all be merged
+     * at once. */
+    while (job.nruns > SORT_MERGE_WAYS)
+    {
+        for (r = 0, m = 0; r < job.nruns; r += n, m++)
+        {
+            n = job.nruns - r < SORT_MERGE_WAYS ? 
+                job.nruns - r : SORT_MERGE_WAYS;
+            if (n == 1)
+            {
+                job.runs[m] = job.runs[r];
+                continue;
+            }
+            strfmt(&tmpname, "%s.runXXXXXX", dst);
+            if ((fd = mkstemp(tmpname)) == -1 || 
+                (out = fdopen(fd, "w")) == NULL)
+                fail("sortfs", tmpname);
+            setvbuf(out, NULL, _IOFBF, SORT_IO_BUF);
+            sort_merge(job.runs + r, n, out, tmpname, key);
+            closefs(out);
+            sort_remove(job.runs + r, n);
+            job.runs[m].tmpname = tmpname;
+        }
+        job.nruns = m;
+    }
+
+    /* Merging the runs into the output file. An empty input has no runs
+     * and gives an empty output. */
+    out = openfs(dst, "w");
+    setvbuf(out, NULL, _IOFBF, SORT_IO_BUF);
+    if (job.nruns > 0)
+        sort_merge(job.runs, job.nruns, out, dst, key);
+    closefs(out);
+
+    /* Cleaning up. */
+    sort_remove(job.runs, job.nruns);
+    free(job.runs);
+    pthread_mutex_destroy(&job.lock);
+
+    return total;
+}
+
+/********************************** CPU **************************************/
+
+/**
+ * These are the names of the levels, as used by MYCUTILS_CPU.
+ */
+static const char* const CPU_LEVEL_NAMES[] = {
+    "scalar", "sse2", "ssse3", "avx2", "avx512"
+    };
+
+/**
+ * These choose the kernels of one part of the library for a level. Each
+ * part with kernels chosen at run time adds its function here, and they are
+ * all run once, by cpu_init().
+ */
+static void sse2_dispatch(enum cpulevels level);
+static void codec_dispatch(enum cpulevels level);
+static void (*const cpu_dispatchers[])(enum cpulevels) = {
+    sse2_dispatch,
+    codec_dispatch
+    };
+
+/**
+ * This is the level found by cpu_init().
+ */
+static enum cpulevels cpu_lvl;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+/**
+ * This function returns the highest level of vector instructions that both
+ * the CPU and the operating system support.
+ */
+static enum cpulevels cpu_detect()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    enum cpulevels level;   /* The level found so far. */
+    unsigned int a;         /* The cpuid registers. */
+    unsigned int b;
+    unsigned int c;
+    unsigned int d;
+    unsigned int lo;        /* The low half of XCR0. */
+    unsigned int hi;        /* The high half of XCR0. */
+
+    level = CPU_SCALAR;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(d & bit_SSE2))
+        return level;
+    level = CPU_SSE2;
+    if (!(c & bit_SSSE3))
+        return level;
+    level = CPU_SSSE3;
+
+    /* AVX registers can only be used if the operating system saves them,
+     * which it says in XCR0: bits 1 and 2 for the XMM and YMM state, and
+     * bits 5 to 7 for the AVX-512 state. */
+    if (!(c & bit_OSXSAVE) || !(c & bit_AVX))
+        return level;
+    __asm__ volatile ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    if ((lo & 0x06) != 0x06 || !__get_cpuid_count(7, 0, &a, &b, &c, &d) ||
+        !(b & bit_AVX2))
+        return level;
+    level = CPU_AVX2;
+    if ((lo & 0xE6) == 0xE6 && (b & bit_AVX512F) && (b & bit_AVX512BW))
+        level = CPU_AVX512;
+    return level;
+#else
+    return CPU_SCALAR;
+#endif
+}
+
+/**
+ * This function chooses between the SSE2 and plain kernels of the CSV, JSON,
+ * string and terminal code.
+ */
+static void sse2_dispatch(enum cpulevels level)
+{
+    cpu_sse2 = level >= CPU_SSE2;
+}
+
+/**
+ * This function finds the level, lowering it to MYCUTILS_CPU if that is
+ * set, and has the kernels for it chosen.
+ */
+static void cpu_init()
+{
+    enum cpulevels level;   /* The level asked for. */
+    char* want;             /* The value of MYCUTILS_CPU. */
+    size_t i;               /* Index of the current dispatcher. */
+
+    cpu_lvl = cpu_detect();
+
+    /* A level above the CPU's would crash, so it can only be lowered. */
+    if ((want = getenv("MYCUTILS_CPU")))
+        for (level = CPU_SCALAR; level <= CPU_AVX512; level++)
+            if (strcmp(want, CPU_LEVEL_NAMES[level]) == 0 && level < cpu_lvl)
+                cpu_lvl = level;
+
+    for (i = 0; i < sizeof(cpu_dispatchers) / sizeof(*cpu_dispatchers); i++)
+        cpu_dispatchers[i](cpu_lvl);
+}
+
+/**
+ * This function returns the highest level of vector instructions that both
+ * the CPU and the operating system support. It is found once, with cpuid
+ * and xgetbv, and the kernels for it are chosen at the same time. Setting
+ * the environment variable MYCUTILS_CPU to scalar, sse2, ssse3, avx2 or
+ * avx512 lowers the level, so slower kernels can be measured and tested.
+ * It applies to every kernel chosen at run time: those of the encoding,
+ * CSV, JSON, string and terminal code.
+ */
+MYCUTILS_API enum cpulevels cpu_level()
+{
+    pthread_once(&cpu_once, cpu_init);
+    return cpu_lvl;
+}
+
+/**
+ * This function returns the name of the level provided to it, as used by
+ * MYCUTILS_CPU.
+ */
+MYCUTILS_API const char* cpu_level_name(enum cpulevels level)
+{
+    return level <= CPU_AVX512 ? CPU_LEVEL_NAMES[level] : "unknown";
+}
+
+/******************************** Strings ************************************/
+
+/**
+ * This function returns the number of bytes a string will need to be
+ * allocated based on the variable argument list and a format string that are
+ * provided to this function.
+ */
+MYCUTILS_API size_t vbytesfmt(va_list lp, char* fmt)
+{
+    va_list lp_cpy; /* A Copy of the list of arguments. */
+    size_t bytes;   /* The number of bytes the string needs. */
+
+    /* Copying the argument list. */
+    va_copy(lp_cpy, lp);
+
+    /* Getting the number of bytes the string will need. Adding an extra
+     * 1 char worth of bytes for the null character. */
+    bytes = vsnprintf(NULL, 0, fmt, lp_cpy) + sizeof(char);
+
+    /* Assuring a clean finish to the copy. */
+    va_end(lp_cpy);
+
+    /* Returning the number of bytes the string will need. */
+    return bytes;
+}
+
+/**
+ * This function dynamically allocates only the needed amount of memory to a
+ * string based on the argument list, then concatenates the argument list into 
+ * the supplied format and stores it in the supplied string pointer.
+ */
+MYCUTILS_API void strfmt(char** sp, char *fmt, ...)
+{
+    va_list lp;     /* Pointer to the list of arguments. */
+    size_t bytes;   /* The number of bytes the string needs. */
+
+    /* Pointing to the first argument. */
+    va_start(lp, fmt);
+
+    /* Getting the number of bytes the string will need to be allocated. */
+    bytes = vbytesfmt(lp, fmt);
+
+    /* Allocating memory to the string. */
+    *sp = (char*) malloc(bytes);
+
+    /* Creating the string. */
+    vsprintf(*sp, fmt, lp);
+
+    /* Assuring a clean finish to the argument list. */
+    va_end(lp);
+}
+
+/**
+ * This function removes the char element from the string provided to it which
+ * is at the element number/index provided to it.
+ */
+MYCUTILS_API void sdelelem(char** sp, unsigned elem)
+{
+    char* s;        /* The new string. */
+    size_t len;     /* The length of the string. */
+
+    /* Checking that the element exists. */
+    if (elem >= (len = strlen(*sp)))
+        return;
+
+    /* Copying the chars either side of the element, and the null
+     * character, into a string that is one char shorter. */
+    s = (char*) malloc(sizeof(char) * len);
+    memcpy(s, *sp, elem);
+    memcpy(s + elem, *sp + elem + 1, len - elem);
+
+    /* Replacing the string. */
+    free(*sp);
+    *sp = s;
+}
+
+/**
+ * This function removes all cases of the provided char from the string at the
+ * provided pointer.
+ */
+MYCUTILS_API void sdelchar(char** sp, char remove)
+{
+    unsigned c;     /* Index of current char in the string. */
+
+    /* Overwriting the unwanted characters. */
+	for (c = 0; c < strlen(*sp); c++)
+	{
+        if ((*sp)[c] == remove)
+        {
+            sdelelem(sp, c);
+
+            /* Decrementing the index so we will check the replacement 
+             * character. */
+            c--;
+        }
+    }
+}
+
+/**
+ * This function joins the n strings in parts, with the separator provided
+ * between each pair, into a string it allocates to the supplied string
+ * pointer. The result is allocated once, at its exact size.
+ */
+MYCUTILS_API void sjoin(char** sp, char** parts, size_t n, char* sep)
+{
+    size_t seplen;  /* The length of the separator. */
+    size_t bytes;   /* The number of bytes the string needs. */
+    size_t len;     /* The length of the current part. */
+    char* out;      /* Where the next part is copied. */
+    size_t p;       /* Index of the current part. */
+
+    /* Adding up the size of the result. */
+    seplen = strlen(sep);
+    bytes = n > 0 ? seplen * (n - 1) + 1 : 1;
+    for (p = 0; p < n; p++)
+        bytes += strlen(parts[p]);
+
+    /* Copying the parts and separators into place. */
+    out = *sp = (char*) malloc(bytes);
+    for (p = 0; p < n; p++)
+    {
+        if (p > 0)
+        {
+            memcpy(out, sep, seplen);
+            out += seplen;
+        }
+        len = strlen(parts[p]);
+        memcpy(out, parts[p], len);
+        out += len;
+    }
+    *out = '\0';
+}
+
+/**
+ * This function returns the first occurrence of the needle of nlen bytes in
+ * the len bytes at hay, or NULL if there isn't one. Sixteen positions are
+ * checked at once by comparing the needle's first and last bytes, and only
+ * positions where both match are compared in full.
+ */
+static const char* sfind(const char* hay, size_t len, 
+                         const char* needle, size_t nlen)
+{
+#ifdef __SSE2__
+    __m128i first;  /* The needle's first byte. */
+    __m128i last;   /* The needle's last byte. */
+    unsigned mask;  /* The positions where both bytes match. */
+#endif
+    size_t i;       /* The current position. */
+
+    if (nlen > len)
+        return NULL;
+
+    i = 0;
+#ifdef __SSE2__
+    cpu_level();
+    first = _mm_set1_epi8(needle[0]);
+    last = _mm_set1_epi8(needle[nlen - 1]);
+    for (; cpu_sse2 && i + nlen - 1 + 16 <= len; i += 16)
+    {
+        mask = _mm_movemask_epi8(_mm_and_si128(
+                _mm_cmpeq_epi8(first, 
+                    _mm_loadu_si128((const __m128i*) (hay + i))),
+                _mm_cmpeq_epi8(last, 
+                    _mm_loadu_si128((const __m128i*) (hay + i + nlen - 1)))));
+        while (mask)
+        {
+            if (memcmp(hay + i + __builtin_ctz(mask), needle, nlen) == 0)
+                return hay + i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + nlen <= len; i++)
+        if (hay[i] == needle[0] && memcmp(hay + i, needle, nlen) == 0)
+            return hay + i;
+    return NULL;
+}
+
+/**
+ * This function copies the string str into a string it allocates to the
+ * supplied string pointer, with every occurrence of needle replaced by
+ * replacement. The result is allocated once, at its exact size. It returns
+ * the number of occurrences replaced.
+ */
+MYCUTILS_API size_t sreplall(char** sp, char* str, char* needle,
+                             char* replacement)
+{
+    size_t len;     /* The length of the string. */
+    size_t nlen;    /* The length of the needle. */
+    size_t rlen;    /* The length of the replacement. */
+    size_t count;   /* The number of occurrences. */
+    const char* p;  /* The rest of the string to search. */
+    const char* at; /* The current occurrence. */
+    char* out;      /* Where the next bytes are copied. */
+
+    len = strlen(str);
+    nlen = strlen(needle);
+    rlen = strlen(replacement);
+
+    /* Copying the string as it is if there is nothing to find. */
+    if (nlen == 0)
+    {
+        strfmt(sp, "%s", str);
+        return 0;
+    }
+
+    /* Counting the occurrences to find the size of the result. */
+    count = 0;
+    for (p = str; (at = sfind(p, len - (p - str), needle, nlen)) != NULL; 
+         p = at + nlen)
+        count++;
+
+    /* Copying the string with the occurrences replaced. */
+    out = *sp = (char*) malloc(len - count * nlen + count * rlen + 1);
+    for (p = str; (at = sfind(p, len - (p - str), needle, nlen)) != NULL; 
+         p = at + nlen)
+    {
+        memcpy(out, p, at - p);
+        out += at - p;
+        memcpy(out, replacement, rlen);
+        out += rlen;
+    }
+    memcpy(out, p, len - (p - str) + 1);
+
+    return count;
+}
+
+/**
+ * This function returns whether the byte provided to it is in the class of
+ * characters provided.
+ */
+static inline bool in_class(unsigned char c, enum charclasses cls)
+{
+    switch (cls)
+    {
+        case CLASS_UPPER    : return c >= 'A' && c <= 'Z';
+        case CLASS_LOWER    : return c >= 'a' && c <= 'z';
+        case CLASS_DIGIT    : return c >= '0' && c <= '9';
+        case CLASS_SPACE    : return c == ' ' || (c >= '\t' && c <= '\r');
+        case CLASS_CONTROL  : return c < 0x20 || c == 0x7F;
+        case CLASS_NONASCII : return c >= 0x80;
+    }
+    return false;
+}
+
+#ifdef __SSE2__
+/**
+ * This function returns a mask of the bytes in v that lie from lo to hi.
+ * Bytes of 0x80 and above compare as negative so are never in the range.
+ */
+static inline __m128i in_range(__m128i v, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), 
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+/**
+ * This function returns a mask of the bytes in v that are in the class of
+ * characters provided.
+ */
+static inline __m128i class_mask(__m128i v, enum charclasses cls)
+{
+    switch (cls)
+    {
+        case CLASS_UPPER    : return in_range(v, 'A', 'Z');
+        case CLASS_LOWER    : return in_range(v, 'a', 'z');
+        case CLASS_DIGIT    : return in_range(v, '0', '9');
+        case CLASS_SPACE    : 
+            return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), 
+                                in_range(v, '\t', '\r'));
+        case CLASS_CONTROL  : 
+            return _mm_or_si128(in_range(v, 0, 0x1F), 
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F)));
+        case CLASS_NONASCII : 
+            return _mm_cmplt_epi8(v, _mm_setzero_si128());
+    }
+    return _mm_setzero_si128();
+}
+#endif
+
+/**
+ * This function writes len bytes from in to out with the bytes in the class
+ * of characters provided XORed with flip.
+ */
+static inline void sflip(char* out, const char* in, size_t len, 
+                         enum charclasses cls, char flip)
+{
+#ifdef __SSE2__
+    __m128i v;  /* Sixteen of the bytes. */
+#endif
+    size_t i;   /* Index of the current byte. */
+
+    i = 0;
+#ifdef __SSE2__
+    cpu_level();
+    for (; cpu_sse2 && i + 16 <= len; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*) (in + i));
+        v = _mm_xor_si128(v, _mm_and_si128(class_mask(v, cls), 
+                                           _mm_set1_epi8(flip)));
+        _mm_storeu_si128((__m128i*) (out + i), v);
+    }
+#endif
+    for (; i < len; i++)
+        out[i] = in_class(in[i], cls) ? in[i] ^ flip : in[i];
+}
+
+/**
+ * This function writes len bytes from in to out with the ASCII letters in
+ * upper case. Other bytes, including UTF-8, are copied as they are. out may
+ * be the same as in. Neither needs a null character.
+ */
+MYCUTILS_API void supper(char* out, const char* in, size_t len)
+{
+    sflip(out, in, len, CLASS_LOWER, 0x20);
+}
+
+/**
+ * This function writes len bytes from in to out with the ASCII letters in
+ * lower case. Other bytes, including UTF-8, are copied as they are. out may
+ * be the same as in. Neither needs a null character.
+ */
+MYCUTILS_API void slower(char* out, const char* in, size_t len)
+{
+    sflip(out, in, len, CLASS_UPPER, 0x20);
+}
+
+/**
+ * This function finds the part of the len bytes at in without leading and
+ * trailing ASCII whitespace. It points start at it and returns its length.
+ */
+MYCUTILS_API size_t strim(const char* in, size_t len, const char** start)
+{
+#ifdef __SSE2__
+    int mask;       /* The bytes in a block that aren't whitespace. */
+#endif
+    size_t b;       /* Index of the first byte kept. */
+    size_t e;       /* Index after the last byte kept. */
+
+    /* Skipping leading whitespace. */
+    b = 0;
+#ifdef __SSE2__
+    cpu_level();
+    for (; cpu_sse2 && b + 16 <= len; b += 16)
+    {
+        mask = ~_mm_movemask_epi8(class_mask(
+                _mm_loadu_si128((const __m128i*) (in + b)), CLASS_SPACE)) 
+               & 0xFFFF;
+        if (mask)
+        {
+            b += __builtin_ctz(mask);
+            break;
+        }
+    }
+#endif
+    while (b < len && in_class(in[b], CLASS_SPACE))
+        b++;
+
+    /* Skipping trailing whitespace. */
+    e = len;
+#ifdef __SSE2__
+    for (; cpu_sse2 && e >= b + 16; e -= 16)
+    {
+        mask = ~_mm_movemask_epi8(class_mask(
+                _mm_loadu_si128((const __m128i*) (in + e - 16)), CLASS_SPACE))
+               & 0xFFFF;
+        if (mask)
+        {
+            e -= __builtin_clz(mask) - 16;
+            break;
+        }
+    }
+#endif
+    while (e > b && in_class(in[e - 1], CLASS_SPACE))
+        e--;
+
+    *start = in + b;
+    return e - b;
+}
+
+/**
+ * This function writes len bytes from in to out with each control
+ * character replaced by the char provided. out may be the same as in. It
+ * returns the number of bytes replaced.
+ */
+MYCUTILS_API size_t sreplctrl(char* out, const char* in, size_t len, char with)
+{
+#ifdef __SSE2__
+    __m128i v;      /* Sixteen of the bytes. */
+    __m128i m;      /* Which of them are control characters. */
+#endif
+    size_t count;   /* The number of bytes replaced. */
+    size_t i;       /* Index of the current byte. */
+
+    count = 0;
+    i = 0;
+#ifdef __SSE2__
+    cpu_level();
+    for (; cpu_sse2 && i + 16 <= len; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*) (in + i));
+        m = class_mask(v, CLASS_CONTROL);
+        count += __builtin_popcount(_mm_movemask_epi8(m));
+        v = _mm_or_si128(_mm_andnot_si128(m, v), 
+                         _mm_and_si128(m, _mm_set1_epi8(with)));
+        _mm_storeu_si128((__m128i*) (out + i), v);
+    }
+#endif
+    for (; i < len; i++)
+    {
+        if (in_class(in[i], CLASS_CONTROL))
+        {
+            out[i] = with;
+            count++;
+        }
+        else
+            out[i] = in[i];
+    }
+    return count;
+}
+
+/**
+ * This function returns the number of the len bytes at in that are in the
+ * class of characters provided.
+ */
+MYCUTILS_API size_t scount(const char* in, size_t len, enum charclasses cls)
+{
+    size_t count;   /* The number of bytes in the class. */
+    size_t i;       /* Index of the current byte. */
+
+    count = 0;
+    i = 0;
+#ifdef __SSE2__
+    cpu_level();
+    for (; cpu_sse2 && i + 16 <= len; i += 16)
+        count += __builtin_popcount(_mm_movemask_epi8(class_mask(
+                    _mm_loadu_si128((const __m128i*) (in + i)), cls)));
+#endif
+    for (; i < len; i++)
+        count += in_class(in[i], cls);
+    return count;
+}
+
+/******************************* Encoding ************************************/
+
+/**
+ * These are the alphabets used for encoding.
+ */
+static const char HEX_DIGITS[] = "0123456789abcdef";
+static const char B64_DIGITS[2][65] = {
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+    };
+
+/**
+ * These map chars back to their values, or -1 for chars that aren't in the
+ * alphabet. They are filled in by codec_dispatch().
+ */
+static int8_t hex_values[256];
+static int8_t b64_values[2][256];
+
+/**
+ * These point at the versions of the encoding kernels that suit the CPU.
+ * Each one handles as much of its input as it can in whole blocks and
+ * returns how many input bytes or chars it used, leaving the rest to the
+ * plain code. They are chosen by codec_dispatch() and left NULL if the CPU
+ * has no suitable vector instructions.
+ */
+static size_t (*hexenc_blocks)(char*, const unsigned char*, size_t);
+static size_t (*hexdec_blocks)(unsigned char*, const char*, size_t, bool*);
+static size_t (*b64enc_blocks)(char*, const unsigned char*, size_t, int);
+static size_t (*b64dec_blocks)(unsigned char*, const char*, size_t, int,
+                               bool*);
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * This function writes sixteen bytes at a time as hex using SSSE3 shuffles
+ * as a nibble lookup table.
+ */
+__attribute__((target("ssse3")))
+static size_t hexenc_ssse3(char* out, const unsigned char* in, size_t len)
+{
+    const __m128i LUT = _mm_loadu_si128((const __m128i*) HEX_DIGITS);
+    const __m128i LOW = _mm_set1_epi8(0x0F);
+    __m128i v;  /* Sixteen input bytes. */
+    __m128i hi; /* The high nibbles as digits. */
+    __m128i lo; /* The low nibbles as digits. */
+    size_t i;   /* Index of the current byte. */
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*) (in + i));
+        hi = _mm_shuffle_epi8(LUT, _mm_and_si128(_mm_srli_epi16(v, 4), LOW));
+        lo = _mm_shuffle_epi8(LUT, _mm_and_si128(v, LOW));
+        _mm_storeu_si128((__m128i*) (out + i * 2), 
+                         _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*) (out + i * 2 + 16), 
+                         _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+/**
+ * This function writes thirty-two bytes at a time as hex using AVX2.
+ */
+__attribute__((target("avx2")))
+static size_t hexenc_avx2(char* out, const unsigned char* in, size_t len)
+{
+    const __m256i LUT = _mm256_broadcastsi128_si256(
+                            _mm_loadu_si128((const __m128i*) HEX_DIGITS));
+    const __m256i LOW = _mm256_set1_epi8(0x0F);
+    __m256i v;  /* Thirty-two input bytes. */
+    __m256i hi; /* The high nibbles as digits. */
+    __m256i lo; /* The low nibbles as digits. */
+    __m256i a;  /* The digits of bytes 0-7 and 16-23. */
+    __m256i b;  /* The digits of bytes 8-15 and 24-31. */
+    size_t i;   /* Index of the current byte. */
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*) (in + i));
+        hi = _mm256_shuffle_epi8(LUT, 
+                _mm256_and_si256(_mm256_srli_epi16(v, 4), LOW));
+        lo = _mm256_shuffle_epi8(LUT, _mm256_and_si256(v, LOW));
+
+        /* Interleaving works within each 128 bit lane, so the halves are
+         * put back in order afterwards. */
+        a = _mm256_unpacklo_epi8(hi, lo);
+        b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*) (out + i * 2), 
+                            _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*) (out + i * 2 + 32), 
+                            _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    return i;
+}
+
+/**
+ * This function writes sixty-four bytes at a time as hex using AVX-512.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static size_t hexenc_avx512(char* out, const unsigned char* in, size_t len)
+{
+    const __m512i LUT = _mm512_broadcast_i32x4(
+                            _mm_loadu_si128((const __m128i*) HEX_DIGITS));
+    const __m512i LOW = _mm512_set1_epi8(0x0F);
+    const __m512i FIRST = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+    const __m512i SECOND = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+    __m512i v;  /* Sixty-four input bytes. */
+    __m512i hi; /* The high nibbles as digits. */
+    __m512i lo; /* The low nibbles as digits. */
+    __m512i a;  /* The digits of the first half of each lane. */
+    __m512i b;  /* The digits of the second half of each lane. */
+    size_t i;   /* Index of the current byte. */
+
+    for (i = 0; i + 64 <= len; i += 64)
+    {
+        v = _mm512_loadu_si512((const void*) (in + i));
+        hi = _mm512_shuffle_epi8(LUT, 
+                _mm512_and_si512(_mm512_srli_epi16(v, 4), LOW));
+        lo = _mm512_shuffle_epi8(LUT, _mm512_and_si512(v, LOW));
+
+        /* Interleaving works within each 128 bit lane, so the lanes are
+         * put back in order afterwards. */
+        a = _mm512_unpacklo_epi8(hi, lo);
+        b = _mm512_unpackhi_epi8(hi, lo);
+        _mm512_storeu_si512((void*) (out + i * 2), 
+                            _mm512_permutex2var_epi64(a, FIRST, b));
+        _mm512_storeu_si512((void*) (out + i * 2 + 64), 
+                            _mm512_permutex2var_epi64(a, SECOND, b));
+    }
+    return i;
+}
+
+/**
+ * This function decodes thirty-two hex chars at a time using SSSE3. It sets
+ * bad if any of them isn't a hex digit.
+ */
+__attribute__((target("ssse3")))
+static size_t hexdec_ssse3(unsigned char* out, const char* in, size_t len,
+                           bool* bad)
+{
+    const __m128i ZERO = _mm_set1_epi8('0');
+    const __m128i LOWER_A = _mm_set1_epi8('a');
+    const __m128i CASE = _mm_set1_epi8(0x20);
+    const __m128i NINE = _mm_set1_epi8(9);
+    const __m128i FIVE = _mm_set1_epi8(5);
+    const __m128i TEN = _mm_set1_epi8(10);
+    const __m128i WEIGHTS = _mm_set1_epi16(0x0110);
+    __m128i c;      /* Sixteen input chars. */
+    __m128i d;      /* The chars as decimal digits. */
+    __m128i a;      /* The chars as letters from a. */
+    __m128i isd;    /* Which chars are decimal digits. */
+    __m128i isa;    /* Which chars are letters from a to f. */
+    __m128i v[2];   /* The values of thirty-two chars. */
+    int h;          /* Index of the current sixteen chars. */
+    size_t i;       /* Index of the current char. */
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+        for (h = 0; h < 2; h++)
+        {
+            /* Working out each char's value both ways, and which is
+             * right. Comparing with min gives an unsigned <=. */
+            c = _mm_loadu_si128((const __m128i*) (in + i + h * 16));
+            d = _mm_sub_epi8(c, ZERO);
+            a = _mm_sub_epi8(_mm_or_si128(c, CASE), LOWER_A);
+            isd = _mm_cmpeq_epi8(_mm_min_epu8(d, NINE), d);
+            isa = _mm_cmpeq_epi8(_mm_min_epu8(a, FIVE), a);
+            if (_mm_movemask_epi8(_mm_or_si128(isd, isa)) != 0xFFFF)
+            {
+                *bad = true;
+                return i;
+            }
+            v[h] = _mm_or_si128(_mm_and_si128(isd, d), 
+                                _mm_and_si128(isa, _mm_add_epi8(a, TEN)));
+
+            /* Combining each pair of nibbles into a byte. */
+            v[h] = _mm_maddubs_epi16(v[h], WEIGHTS);
+        }
+        _mm_storeu_si128((__m128i*) (out + i / 2), 
+                         _mm_packus_epi16(v[0], v[1]));
+    }
+    return i;
+}
+
+/**
+ * This function turns the 6 bit values in v into base64 chars of the
+ * alphabet provided.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i b64_ascii_ssse3(__m128i v, int alpha)
+{
+    const __m128i SHIFTS = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, 
+        B64_DIGITS[alpha][62] - 62, B64_DIGITS[alpha][63] - 63, 'A', 0, 0);
+    __m128i r;  /* The index of each value's shift. */
+
+    /* Values 0-25 use index 13, 26-51 index 0, 52-61 indexes 1-10, and
+     * 62 and 63 indexes 11 and 12. */
+    r = _mm_subs_epu8(v, _mm_set1_epi8(51));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), v), 
+                                      _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(SHIFTS, r), v);
+}
+
+/**
+ * This function encodes twelve bytes at a time as base64 using SSSE3.
+ */
+__attribute__((target("ssse3")))
+static size_t b64enc_ssse3(char* out, const unsigned char* in, size_t len,
+                           int alpha)
+{
+    const __m128i SPREAD = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 
+                                         7, 6, 8, 7, 10, 9, 11, 10);
+    __m128i v;  /* Twelve input bytes spread over four 32 bit lanes. */
+    __m128i a;  /* The first and third 6 bit values of each lane. */
+    __m128i b;  /* The second and fourth 6 bit values of each lane. */
+    size_t i;   /* Index of the current byte. */
+    size_t o;   /* Index of the current char. */
+
+    /* Sixteen bytes are loaded for each twelve used. */
+    for (i = 0, o = 0; i + 16 <= len; i += 12, o += 16)
+    {
+        v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (in + i)), 
+                             SPREAD);
+        a = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0FC0FC00)), 
+                            _mm_set1_epi32(0x04000040));
+        b = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003F03F0)), 
+                            _mm_set1_epi32(0x01000010));
+        _mm_storeu_si128((__m128i*) (out + o), 
+                         b64_ascii_ssse3(_mm_or_si128(a, b), alpha));
+    }
+    return i;
+}
+
+/**
+ * This function returns a mask of the chars in c that lie from lo to hi,
+ * with each of them turned into its value by adding add.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i b64_range(__m128i c, char lo, char hi, char add, 
+                                __m128i* vals)
+{
+    __m128i d;  /* The chars less lo. */
+    __m128i in; /* Which chars are in the range. */
+
+    d = _mm_sub_epi8(c, _mm_set1_epi8(lo));
+    in = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(hi - lo)), d);
+    *vals = _mm_or_si128(*vals, 
+                         _mm_and_si128(in, _mm_add_epi8(c, _mm_set1_epi8(add))));
+    return in;
+}
+
+/**
+ * This function decodes sixteen base64 chars at a time using SSSE3. It
+ * stops while at least eight chars remain, since each block stores sixteen
+ * bytes of which only twelve are used. It sets bad if a char isn't in the
+ * alphabet.
+ */
+__attribute__((target("ssse3")))
+static size_t b64dec_ssse3(unsigned char* out, const char* in, size_t len,
+                           int alpha, bool* bad)
+{
+    const __m128i GATHER = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 
+                                         14, 13, 12, -1, -1, -1, -1);
+    __m128i c;      /* Sixteen input chars. */
+    __m128i vals;   /* Their 6 bit values. */
+    __m128i ok;     /* Which chars are in the alphabet. */
+    size_t i;       /* Index of the current char. */
+    size_t o;       /* Index of the current byte. */
+
+    for (i = 0, o = 0; i + 24 <= len; i += 16, o += 12)
+    {
+        /* Finding each char's value. */
+        c = _mm_loadu_si128((const __m128i*) (in + i));
+        vals = _mm_setzero_si128();
+        ok = b64_range(c, 'A', 'Z', -'A', &vals);
+        ok = _mm_or_si128(ok, b64_range(c, 'a', 'z', 26 - 'a', &vals));
+        ok = _mm_or_si128(ok, b64_range(c, '0', '9', 52 - '0', &vals));
+        ok = _mm_or_si128(ok, b64_range(c, B64_DIGITS[alpha][62], 
+                                        B64_DIGITS[alpha][62], 
+                                        62 - B64_DIGITS[alpha][62], &vals));
+        ok = _mm_or_si128(ok, b64_range(c, B64_DIGITS[alpha][63], 
+                                        B64_DIGITS[alpha][63], 
+                                        63 - B64_DIGITS[alpha][63], &vals));
+        if (_mm_movemask_epi8(ok) != 0xFFFF)
+        {
+            *bad = true;
+            return i;
+        }
+
+        /* Packing each four 6 bit values into three bytes. */
+        vals = _mm_maddubs_epi16(vals, _mm_set1_epi32(0x01400140));
+        vals = _mm_madd_epi16(vals, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i*) (out + o), 
+                         _mm_shuffle_epi8(vals, GATHER));
+    }
+    return i;
+}
+#endif
+
+/**
+ * This function fills in the decoding tables and chooses the kernels for
+ * the level provided to it.
+ */
+static void codec_dispatch(enum cpulevels level)
+{
+    int a;  /* Index of the current alphabet. */
+    int c;  /* The current char. */
+
+    /* Filling in the decoding tables. */
+    memset(hex_values, -1, sizeof(hex_values));
+    memset(b64_values, -1, sizeof(b64_values));
+    for (c = 0; c < 16; c++)
+    {
+        hex_values[(unsigned char) HEX_DIGITS[c]] = c;
+        hex_values[toupper((unsigned char) HEX_DIGITS[c])] = c;
+    }
+    for (a = 0; a < 2; a++)
+        for (c = 0; c < 64; c++)
+            b64_values[a][(unsigned char) B64_DIGITS[a][c]] = c;
+
+    /* Choosing the kernels. */
+#if defined(__x86_64__) || defined(__i386__)
+    if (level >= CPU_SSSE3)
+    {
+        hexenc_blocks = hexenc_ssse3;
+        hexdec_blocks = hexdec_ssse3;
+        b64enc_blocks = b64enc_ssse3;
+        b64dec_blocks = b64dec_ssse3;
+    }
+    if (level >= CPU_AVX2)
+        hexenc_blocks = hexenc_avx2;
+    if (level >= CPU_AVX512)
+        hexenc_blocks = hexenc_avx512;
+#else
+    (void) level;
+#endif
+}
+
+/**
+ * This function writes len bytes from in as lowercase hex to out, which must
+ * have room for HEXENC_LEN(len) chars. No null character is written. It
+ * returns the number of chars written. The fastest of the AVX-512, AVX2,
+ * SSSE3 and plain versions allowed by cpu_level() is used.
+ */
+MYCUTILS_API size_t hexenc(char* out, const void* in, size_t len)
+{
+    const unsigned char* p; /* The input bytes. */
+    size_t i;               /* Index of the current byte. */
+
+    cpu_level();
+    p = (const unsigned char*) in;
+
+    /* Encoding whole blocks, then the rest a byte at a time. */
+    for (i = hexenc_blocks ? hexenc_blocks(out, p, len) : 0; i < len; i++)
+    {
+        out[i * 2] = HEX_DIGITS[p[i] >> 4];
+        out[i * 2 + 1] = HEX_DIGITS[p[i] & 0xF];
+    }
+    return len * 2;
+}
+
+/**
+ * This function writes the bytes encoded by len chars of hex from in, in
+ * either case, to out, which must have room for len / 2 bytes. It returns
+ * the number of bytes written, or (size_t) -1 if the input isn't valid hex.
+ */
+MYCUTILS_API size_t hexdec(void* out, const char* in, size_t len)
+{
+    unsigned char* p;   /* The output bytes. */
+    bool bad;           /* Whether the input is invalid. */
+    int hi;             /* The value of the current high nibble. */
+    int lo;             /* The value of the current low nibble. */
+    size_t i;           /* Index of the current char. */
+
+    cpu_level();
+    p = (unsigned char*) out;
+    if (len % 2 != 0)
+        return (size_t) -1;
+
+    /* Decoding whole blocks, then the rest a pair at a time. */
+    bad = false;
+    i = hexdec_blocks ? hexdec_blocks(p, in, len, &bad) : 0;
+    for (; !bad && i < len; i += 2)
+    {
+        hi = hex_values[(unsigned char) in[i]];
+        lo = hex_values[(unsigned char) in[i + 1]];
+        if ((hi | lo) < 0)
+            return (size_t) -1;
+        p[i / 2] = hi << 4 | lo;
+    }
+    return bad ? (size_t) -1 : len / 2;
+}
+
+/**
+ * This function writes len bytes from in as base64 in the alphabet provided
+ * to out, which must have room for B64ENC_LEN(len) chars. No null character
+ * is written. It returns the number of chars written.
+ */
+MYCUTILS_API size_t b64enc(char* out, const void* in, size_t len,
+                           enum b64alphabets alpha)
+{
+    const char* digits;     /* The alphabet. */
+    const unsigned char* p; /* The input bytes. */
+    uint32_t v;             /* Three bytes of input. */
+    size_t i;               /* Index of the current byte. */
+    size_t o;               /* Index of the current char. */
+
+    cpu_level();
+    digits = B64_DIGITS[alpha];
+    p = (const unsigned char*) in;
+
+    /* Encoding whole blocks, then whole groups of three bytes. */
+    i = b64enc_blocks ? b64enc_blocks(out, p, len, alpha) : 0;
+    for (o = i / 3 * 4; i + 3 <= len; i += 3, o += 4)
+    {
+        v = (uint32_t) p[i] << 16 | p[i + 1] << 8 | p[i + 2];
+        out[o] = digits[v >> 18];
+        out[o + 1] = digits[(v >> 12) & 0x3F];
+        out[o + 2] = digits[(v >> 6) & 0x3F];
+        out[o + 3] = digits[v & 0x3F];
+    }
+
+    /* Encoding the last one or two bytes. */
+    if (i < len)
+    {
+        v = (uint32_t) p[i] << 16 | (i + 1 < len ? p[i + 1] << 8 : 0);
+        out[o++] = digits[v >> 18];
+        out[o++] = digits[(v >> 12) & 0x3F];
+        if (i + 1 < len)
+            out[o++] = digits[(v >> 6) & 0x3F];
+        else if (alpha == B64_STD)
+            out[o++] = '=';
+        if (alpha == B64_STD)
+            out[o++] = '=';
+    }
+    return o;
+}
+
+/**
+ * This function writes the bytes encoded by len chars of base64 in the
+ * alphabet provided to out, which must have room for B64DEC_LEN(len) bytes.
+ * Padding is optional. It returns the number of bytes written, or
+ * (size_t) -1 if the input isn't valid base64.
+ */
+MYCUTILS_API size_t b64dec(void* out, const char* in, size_t len,
+                           enum b64alphabets alpha)
+{
+    const int8_t* values;   /* The value of each char. */
+    unsigned char* p;       /* The output bytes. */
+    uint32_t v;             /* The value of a group of chars. */
+    int8_t d;               /* The value of the current char. */
+    bool bad;               /* Whether the input is invalid. */
+    size_t left;            /* The number of chars in the last group. */
+    size_t i;               /* Index of the current char. */
+    size_t o;               /* Index of the current byte. */
+    size_t c;               /* Index of a char in the last group. */
+
+    cpu_level();
+    values = b64_values[alpha];
+    p = (unsigned char*) out;
+
+    /* Ignoring padding. */
+    if (len % 4 == 0 && len > 0 && in[len - 1] == '=')
+        len -= in[len - 2] == '=' ? 2 : 1;
+    if (len % 4 == 1)
+        return (size_t) -1;
+
+    /* Decoding whole blocks. */
+    bad = false;
+    i = b64dec_blocks ? b64dec_blocks(p, in, len, alpha, &bad) : 0;
+    if (bad)
+        return (size_t) -1;
+
+    /* Decoding the remaining groups of four chars. Any invalid char makes
+     * the value negative. */
+    for (o = i / 4 * 3; i + 4 <= len; i += 4, o += 3)
+    {
+        v = (uint32_t) values[(unsigned char) in[i]] << 18 |
+            (uint32_t) values[(unsigned char) in[i + 1]] << 12 |
+            (uint32_t) values[(unsigned char) in[i + 2]] << 6 |
+            (uint32_t) values[(unsigned char) in[i + 3]];
+        if ((values[(unsigned char) in[i]] | values[(unsigned char) in[i + 1]] |
+             values[(unsigned char) in[i + 2]] | 
+             values[(unsigned char) in[i + 3]]) < 0)
+            return (size_t) -1;
+        p[o] = v >> 16;
+        p[o + 1] = v >> 8;
+        p[o + 2] = v;
+    }
+
+    /* Decoding the last two or three chars. */
+    if ((left = len - i) > 0)
+    {
+        for (v = 0, c = 0; c < 4; c++)
+        {
+            d = c < left ? values[(unsigned char) in[i + c]] : 0;
+            if (d < 0)
+                return (size_t) -1;
+            v = v << 6 | d;
+        }
+        p[o++] = v >> 16;
+        if (left == 3)
+            p[o++] = v >> 8;
+    }
+    return o;
+}
+
+/**************************** Flight recorder ********************************/
+
+/**
+ * Each thread records into its own ring so recording needs no locks and is
+ * only a few plain stores.
+ */
+static __thread flight_event flight_ring[FLIGHT_EVENTS];
+static __thread uint64_t flight_head;
+
+/**
+ * The dump path is kept in static storage so that it can be read safely
+ * from within a signal handler. It is empty, so nothing is dumped, until
+ * flight_set_path() or the MYCUTILS_FLIGHT environment variable sets it.
+ */
+static char flight_path[FLIGHT_PATH_MAX];
+static volatile sig_atomic_t flight_env_read;
+
+/**
+ * This function takes the dump path from the MYCUTILS_FLIGHT environment
+ * variable the first time it is called, unless a path has been set already.
+ */
+static void flight_env()
+{
+    char* env;  /* The value of MYCUTILS_FLIGHT. */
+
+    if (flight_env_read)
+        return;
+    flight_env_read = true;
+    if (flight_path[0] == '\0' && (env = getenv("MYCUTILS_FLIGHT")) != NULL)
+    {
+        strncpy(flight_path, env, FLIGHT_PATH_MAX - 1);
+        flight_path[FLIGHT_PATH_MAX - 1] = '\0';
+    }
+}
+
+/**
+ * This function records an event in the calling thread's flight recorder.
+ */
+MYCUTILS_API void flight_record(enum flight_ops op, int fd, int64_t size)
+{
+    flight_event* ev;   /* The slot the event is recorded in. */
+    struct timespec ts; /* The time of the event. */
+
+    /* Getting a cheap timestamp. The coarse clock is served by the vDSO
+     * without a system call. */
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+    /* Storing the event, overwriting the oldest one. */
+    ev = &flight_ring[flight_head++ & (FLIGHT_EVENTS - 1)];
+    ev->ns = (uint64_t) ts.tv_sec * NANOS_PER_SEC + ts.tv_nsec;
+    ev->op = op;
+    ev->fd = fd;
+    ev->size = size;
+}
+
+/**
+ * This function writes all of the bytes provided to it to the file
+ * descriptor provided to it, using only async-signal-safe calls. It returns
+ * false if they couldn't all be written.
+ */
+static bool write_all(int fd, const char* buf, size_t len)
+{
+    ssize_t n;  /* The number of bytes written by one call to write(). */
+
+    while (len > 0)
+    {
+        if ((n = write(fd, buf, len)) <= 0)
+        {
+            /* Retrying if we were interrupted, otherwise giving up. */
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * This function writes the calling thread's recent events, oldest first, to
+ * the flight recorder's dump file. Nothing is written unless a dump file
+ * has been set by flight_set_path() or the MYCUTILS_FLIGHT environment
+ * variable. Once flight_catch_signals() has been called it only uses
+ * async-signal-safe calls, so it may be called from a signal handler.
+ */
+MYCUTILS_API void flight_dump()
+{
+    int fd;             /* The dump file's descriptor. */
+    int saved_errno;    /* The errno from before the dump. */
+    uint64_t oldest;    /* Ring index of the oldest event. */
+    uint64_t count;     /* The number of events recorded. */
+    uint64_t first;     /* The number of events before the ring wraps. */
+
+    /* Dumping nothing unless a dump file has been asked for. */
+    flight_env();
+    if (flight_path[0] == '\0')
+        return;
+
+    /* Keeping errno intact for the caller's error message. */
+    saved_errno = errno;
+
+    /* Opening the dump file. */
+    if ((fd = open(flight_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+    {
+        errno = saved_errno;
+        return;
+    }
+
+    /* Working out where the recorded events start. */
+    count = flight_head < FLIGHT_EVENTS ? flight_head : FLIGHT_EVENTS;
+    oldest = (flight_head - count) & (FLIGHT_EVENTS - 1);
+    first = FLIGHT_EVENTS - oldest < count ? FLIGHT_EVENTS - oldest : count;
+
+    /* Writing the events in the order they happened. */
+    write_all(fd, (const char*) &flight_ring[oldest], 
+                 first * sizeof(flight_event));
+    write_all(fd, (const char*) &flight_ring[0], 
+                 (count - first) * sizeof(flight_event));
+
+    /* Closing the dump file. */
+    close(fd);
+    errno = saved_errno;
+}
+
+/**
+ * This function sets the path of the file the flight recorder dumps to,
+ * which turns dumping on. An empty path turns it off again.
+ */
+MYCUTILS_API void flight_set_path(char* path)
+{
+    flight_env_read = true;
+    strncpy(flight_path, path, FLIGHT_PATH_MAX - 1);
+    flight_path[FLIGHT_PATH_MAX - 1] = '\0';
+}
+
+/**
+ * This function is the handler for fatal signals. It dumps the flight
+ * recorder then re-raises the signal with its default action, which was
+ * restored by SA_RESETHAND.
+ */
+static void flight_on_signal(int sig)
+{
+    flight_dump();
+    raise(sig);
+}
+
+/**
+ * This function installs signal handlers that dump the flight recorder when
+ * the program receives a fatal signal.
+ */
+MYCUTILS_API void flight_catch_signals()
+{
+    const int SIGNALS[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    struct sigaction sa;    /* The action to take on a signal. */
+    unsigned s;             /* Index of the current signal. */
+
+    /* Reading MYCUTILS_FLIGHT now so the handler doesn't call getenv(),
+     * which isn't async-signal-safe. */
+    flight_env();
+
+    /* Creating the action. */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = flight_on_signal;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+
+    /* Installing the action for each fatal signal. */
+    for (s = 0; s < sizeof(SIGNALS) / sizeof(SIGNALS[0]); s++)
+        sigaction(SIGNALS[s], &sa, NULL);
+}
+
+/******************************* Terminal ************************************/
+
+/**
+ * This is the size of the terminal output buffer.
+ */
+#define TERM_BUF_SIZE (16 * 1024)
+
+/**
+ * Output to the terminal is gathered here and written with one system call
+ * by term_flush(). Each thread has its own buffer, so threads printing at
+ * once can't corrupt it and their output is only interleaved between
+ * flushes.
+ */
+static __thread char term_buf[TERM_BUF_SIZE];
+static __thread size_t term_len;
+
+/**
+ * This function writes out anything in the calling thread's terminal output
+ * buffer. Each thread gathers its output, and keeps its cache of wrapped
+ * strings, on its own rather than behind a lock, so threads may print at
+ * the same time and their output is only interleaved between flushes.
+ */
+MYCUTILS_API void term_flush()
+{
+    /* Keeping output already buffered by stdio in order. */
+    fflush(stdout);
+    write_all(STDOUT_FILENO, term_buf, term_len);
+    term_len = 0;
+}
+
+/**
+ * This function adds len bytes to the terminal output buffer, flushing it
+ * when it is full.
+ */
+static void term_put(const char* p, size_t len)
+{
+    size_t n;   /* The number of bytes that fit. */
+
+    while (len > 0)
+    {
+        if (term_len == TERM_BUF_SIZE)
+            term_flush();
+        n = TERM_BUF_SIZE - term_len < len ? TERM_BUF_SIZE - term_len : len;
+        memcpy(term_buf + term_len, p, n);
+        term_len += n;
+        p += n;
+        len -= n;
+    }
+}
+
+/**
+ * This function returns the offset of the first control character in the
+ * len bytes at p, or len if there isn't one.
+ */
+static size_t term_scan(const char* p, size_t len)
+{
+#ifdef __SSE2__
+    int mask;   /* The control characters in a block. */
+#endif
+    size_t i;   /* Index of the current byte. */
+
+    i = 0;
+#ifdef __SSE2__
+    cpu_level();
+    for (; cpu_sse2 && i + 16 <= len; i += 16)
+        if ((mask = _mm_movemask_epi8(class_mask(
+                _mm_loadu_si128((const __m128i*) (p + i)), CLASS_CONTROL))))
+            return i + __builtin_ctz(mask);
+#endif
+    for (; i < len; i++)
+        if (in_class(p[i], CLASS_CONTROL))
+            return i;
+    return len;
+}
+
+/**
+ * This function adds len bytes of text to the terminal output buffer.
+ * Runs of printable bytes are copied whole and each control character is
+ * replaced by its caret notation, so the text can't move the cursor or
+ * change the terminal's state.
+ */
+static void term_text(const char* p, size_t len)
+{
+    char caret[2];  /* The caret notation of a control character. */
+    size_t run;     /* The length of a run of printable bytes. */
+
+    while (len > 0)
+    {
+        /* Copying the printable bytes. */
+        run = term_scan(p, len);
+        term_put(p, run);
+        p += run;
+        len -= run;
+        if (len == 0)
+            break;
+
+        /* Showing the control character that ended the run. */
+        caret[0] = '^';
+        caret[1] = *p ^ 0x40;
+        term_put(caret, 2);
+        p++;
+        len--;
+    }
+}
+
+/**
+ * These are the terminal capabilities the library uses.
+ */
+enum termcaps {
+    CAP_CLEAR,
+    CAP_EL,
+    CAP_EL1,
+    CAP_CUP,
+    CAP_CUU,
+    CAP_CUD,
+    CAP_CUB,
+    CAP_CUF,
+    CAP_BOLD,
+    CAP_SGR0,
+    CAP_BLINK,
+    CAP_SMSO,
+    CAP_SMUL,
+    CAP_SETAF,
+    CAP_SETAB,
+    CAP_OP,
+    NUM_CAPS
+};
+
+/**
+ * This is where each capability is in a terminfo entry's string table.
+ */
+static const short cap_index[NUM_CAPS] = {
+    5, 6, 269, 10, 114, 107, 111, 112, 27, 39, 26, 35, 36, 359, 360, 297
+};
+
+/**
+ * These are the capabilities used when there is no terminfo entry.
+ */
+static const char* const cap_ansi[NUM_CAPS] = {
+    "\033[H\033[2J", "\033[K", "\033[1K", "\033[%i%p1%d;%p2%dH",
+    "\033[%p1%dA", "\033[%p1%dB", "\033[%p1%dD", "\033[%p1%dC",
+    "\033[1m", "\033[0m", "\033[5m", "\033[7m", "\033[4m",
+    "\033[3%p1%dm", "\033[4%p1%dm", "\033[39;49m"
+};
+
+/**
+ * This identifies a terminal capability cache file and its layout.
+ */
+#define TERMDB_MAGIC 0x3242444D
+
+/**
+ * This is the number of colours whose sequences are worked out in advance.
+ */
+#define TERMDB_COLOURS 256
+
+/**
+ * This is the longest a terminfo path or worked out sequence can be.
+ */
+#define TERMDB_PATH_MAX 256
+#define TERMDB_SEQ_MAX 64
+
+/**
+ * This is a terminal capability table. It is written to a cache file as it
+ * is, followed by its strings, so later runs only have to map it. Offsets
+ * are from the start of the table, and 0 means the terminal doesn't have
+ * the capability.
+ */
+struct termdb {
+    uint32_t magic;                 /* TERMDB_MAGIC. */
+    uint32_t size;                  /* The size of the table and strings. */
+    int64_t mtime_sec;              /* When the terminfo entry changed. */
+    int64_t mtime_nsec;
+    int64_t tisize;                 /* The size of the terminfo entry. */
+    char path[TERMDB_PATH_MAX];     /* The terminfo entry's path. */
+    int32_t cols;                   /* The entry's columns, or -1. */
+    int32_t lines;                  /* The entry's lines, or -1. */
+    uint32_t caps[NUM_CAPS];        /* Each capability. */
+    uint32_t fg[TERMDB_COLOURS];    /* Each foreground colour's sequence. */
+    uint32_t bg[TERMDB_COLOURS];    /* Each background colour's sequence. */
+};
+
+/**
+ * The capability table is found once, the first time it is needed.
+ */
+static const struct termdb* termdb;
+static pthread_once_t termdb_once = PTHREAD_ONCE_INIT;
+
+/**
+ * This function skips the parameterised capability provided to it past the
+ * %; that ends the current conditional, or past its %e if to_else is true
+ * and it has one, returning where to carry on.
+ */
+static const char* cap_skip(const char* cap, bool to_else)
+{
+    int depth;  /* How deeply nested conditionals are. */
+    char c;     /* The current operator. */
+
+    for (depth = 0; *cap; )
+    {
+        if (*cap++ != '%' || !*cap)
+            continue;
+        c = *cap++;
+        if (c == '?')
+            depth++;
+        else if (c == ';' && depth-- == 0)
+            break;
+        else if (c == 'e' && to_else && depth == 0)
+            break;
+    }
+    return cap;
+}
+
+/**
+ * This function works out the parameterised capability provided to it with
+ * the parameters p1 and p2, putting the sequence in out, which holds size
+ * bytes. It understands the terminfo parameter language and leaves out
+ * padding. It returns the length of the sequence.
+ */
+static size_t cap_param(char* out, size_t size, const char* cap, 
+                        int p1, int p2)
+{
+    int params[9] = { p1, p2 };     /* The parameters. */
+    int vars[52] = { 0 };           /* The dynamic and static variables. */
+    int stack[32];                  /* The stack. */
+    int sp;                         /* The number of values on the stack. */
+    int a;                          /* The first operand. */
+    int b;                          /* The second operand. */
+    char fmt[16];                   /* A printf() format. */
+    size_t n;                       /* The length of a format. */
+    size_t len;                     /* The length of the sequence. */
+    char c;                         /* The current character. */
+
+#define CAP_PUSH(v) (sp < 32 ? (void) (stack[sp++] = (v)) : (void) 0)
+#define CAP_POP() (sp > 0 ? stack[--sp] : 0)
+#define CAP_OUT(ch) (len + 1 < size ? (void) (out[len++] = (ch)) : (void) 0)
+
+    sp = 0;
+    len = 0;
+    while ((c = *cap++))
+    {
+        /* Leaving out padding. */
+        if (c == '$' && *cap == '<' && strchr(cap, '>'))
+        {
+            cap = strchr(cap, '>') + 1;
+            continue;
+        }
+        if (c != '%')
+        {
+            CAP_OUT(c);
+            continue;
+        }
+
+        switch (c = *cap++)
+        {
+            case '%' : CAP_OUT('%'); break;
+            case 'c' : CAP_OUT((char) CAP_POP()); break;
+            case 'p' : if (*cap >= '1' && *cap <= '9')
+                           CAP_PUSH(params[*cap - '1']);
+                       cap++;
+                       break;
+            case 'P' : a = CAP_POP();
+                       if (islower(*cap)) vars[*cap - 'a'] = a;
+                       else if (isupper(*cap)) vars[26 + *cap - 'A'] = a;
+                       cap++;
+                       break;
+            case 'g' : if (islower(*cap)) CAP_PUSH(vars[*cap - 'a']);
+                       else if (isupper(*cap)) CAP_PUSH(vars[26+*cap-'A']);
+                       cap++;
+                       break;
+            case '\'': CAP_PUSH((unsigned char) *cap);
+                       cap += cap[1] == '\'' ? 2 : 1;
+                       break;
+            case '{' : CAP_PUSH(atoi(cap));
+                       while (*cap && *cap++ != '}');
+                       break;
+            case 'i' : params[0]++; params[1]++; break;
+            case 'l' : CAP_PUSH(0); break;
+            case '!' : a = CAP_POP(); CAP_PUSH(!a); break;
+            case '~' : a = CAP_POP(); CAP_PUSH(~a); break;
+            case '+' : case '-' : case '*' : case '/' : case 'm' :
+            case '&' : case '|' : case '^' : case '=' : case '>' :
+            case '<' : case 'A' : case 'O' :
+                       b = CAP_POP();
+                       a = CAP_POP();
+                       switch (c)
+                       {
+                           case '+' : CAP_PUSH(a + b); break;
+                           case '-' : CAP_PUSH(a - b); break;
+                           case '*' : CAP_PUSH(a * b); break;
+                           case '/' : CAP_PUSH(b ? a / b : 0); break;
+                           case 'm' : CAP_PUSH(b ? a % b : 0); break;
+                           case '&' : CAP_PUSH(a & b); break;
+                           case '|' : CAP_PUSH(a | b); break;
+                           case '^' : CAP_PUSH(a ^ b); break;
+                           case '=' : CAP_PUSH(a == b); break;
+                           case '>' : CAP_PUSH(a > b); break;
+                           case '<' : CAP_PUSH(a < b); break;
+                           case 'A' : CAP_PUSH(a && b); break;
+                           case 'O' : CAP_PUSH(a || b); break;
+                       }
+                       break;
+            case '?' : case ';' : break;
+            case 't' : if (!CAP_POP())
+                           cap = cap_skip(cap, true);
+                       break;
+            case 'e' : cap = cap_skip(cap, false); break;
+            default :
+                /* Printing a number with its flags, width and precision. */
+                n = 0;
+                fmt[n++] = '%';
+                if (c == ':')
+                    c = *cap++;
+                while (c && strchr("-+# .0123456789", c) && n < 12)
+                {
+                    fmt[n++] = c;
+                    c = *cap++;
+                }
+                if (!c || !strchr("doxXs", c))
+                    return (out[len] = '\0', len);
+                fmt[n++] = c == 's' ? 'd' : c;
+                fmt[n] = '\0';
+                n = snprintf(out + len, size - len, fmt, CAP_POP());
+                len = len + n < size ? len + n : size - 1;
+                break;
+        }
+    }
+    out[len] = '\0';
+    return len;
+
+#undef CAP_PUSH
+#undef CAP_POP
+#undef CAP_OUT
+}
+
+/**
+ * This function finds the terminfo entry of the terminal named term, putting
+ * its path in path and its details in st. It returns false if there isn't
+ * one.
+ */
+static bool find_terminfo(const char* term, char* path, struct stat* st)
+{
+    char dirs[1024];    /* The directories to look in. */
+    char* home;         /* The home directory. */
+    char* dir;          /* The current directory. */
+    char* save;         /* strtok_r()'s place. */
+
+    /* Gathering the directories in the order ncurses looks in them. */
+    home = getenv("HOME");
+    snprintf(dirs, sizeof(dirs), "%s:%s%s:%s:/etc/terminfo:/lib/terminfo:"
+             "/usr/share/terminfo", getenv("TERMINFO") ? getenv("TERMINFO") 
+             : "", home ? home : "", home ? "/.terminfo" : "", 
+             getenv("TERMINFO_DIRS") ? getenv("TERMINFO_DIRS") : "");
+
+    for (dir = strtok_r(dirs, ":", &save); dir; 
+         dir = strtok_r(NULL, ":", &save))
+    {
+        /* Entries are under their first letter, or its hex code. */
+        snprintf(path, TERMDB_PATH_MAX, "%s/%c/%s", dir, term[0], term);
+        if (stat(path, st) == 0)
+            return true;
+        snprintf(path, TERMDB_PATH_MAX, "%s/%02x/%s", dir, term[0], term);
+        if (stat(path, st) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * This function returns the little-endian number of width bytes at p.
+ */
+static int ti_num(const unsigned char* p, int width)
+{
+    return width == 2 ? (int16_t) (p[0] | p[1] << 8)
+                      : (int32_t) (p[0] | p[1] << 8 | p[2] << 16 | 
+                                   (uint32_t) p[3] << 24);
+}
+
+/**
+ * This function reads the capabilities the library uses from the terminfo
+ * entry at path into caps, and the numbers of colours, columns and lines
+ * into nums, with -1 for any it doesn't have. Strings are copied into pool,
+ * which holds TERMDB_PATH_MAX * NUM_CAPS bytes. It returns false if the
+ * entry can't be read.
+ */
+static bool read_terminfo(const char* path, const char** caps, int nums[3],
+                          char* pool)
+{
+    unsigned char* ti;  /* The entry. */
+    unsigned char* p;   /* The current section of the entry. */
+    struct stat st;     /* The entry's details. */
+    int fd;             /* The entry's file descriptor. */
+    int width;          /* The size of a number. */
+    int hdr[6];         /* The header. */
+    int off;            /* A string's offset. */
+    int i;              /* The current capability. */
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return false;
+    if (fstat(fd, &st) == -1 || st.st_size < 12 || st.st_size > 1 << 20)
+    {
+        close(fd);
+        return false;
+    }
+    ti = (unsigned char*) malloc(st.st_size);
+    if (read(fd, ti, st.st_size) != st.st_size)
+    {
+        free(ti);
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    /* Reading the header. 0432 has 16 bit numbers and 01036 32 bit. */
+    for (i = 0; i < 6; i++)
+        hdr[i] = ti_num(ti + i * 2, 2);
+    width = hdr[0] == 01036 ? 4 : 2;
+    if ((hdr[0] != 0432 && hdr[0] != 01036) || hdr[1] < 0 || hdr[2] < 0 ||
+        hdr[3] < 0 || hdr[4] < 0 || hdr[5] < 0 ||
+        12 + hdr[1] + hdr[2] + ((hdr[1] + hdr[2]) & 1) + hdr[3] * width + 
+            hdr[4] * 2 + hdr[5] > st.st_size)
+    {
+        free(ti);
+        return false;
+    }
+
+    /* Skipping the names and booleans; numbers start on an even byte. */
+    p = ti + 12 + hdr[1] + hdr[2];
+    if ((p - ti) & 1)
+        p++;
+    nums[0] = hdr[3] > 13 ? ti_num(p + 13 * width, width) : -1;
+    nums[1] = hdr[3] > 0 ? ti_num(p, width) : -1;
+    nums[2] = hdr[3] > 2 ? ti_num(p + 2 * width, width) : -1;
+    p += hdr[3] * width;
+
+    /* Copying the strings out of the string table. */
+    for (i = 0; i < NUM_CAPS; i++)
+    {
+        caps[i] = NULL;
+        if (cap_index[i] >= hdr[4])
+            continue;
+        off = ti_num(p + cap_index[i] * 2, 2);
+        if (off < 0 || off >= hdr[5])
+            continue;
+        snprintf(pool, TERMDB_PATH_MAX, "%.*s", 
+                 (int) strnlen((char*) p + hdr[4] * 2 + off, hdr[5] - off),
+                 (char*) p + hdr[4] * 2 + off);
+        caps[i] = pool;
+        pool += TERMDB_PATH_MAX;
+    }
+    free(ti);
+    return true;
+}
+
+/**
+ * This function adds len bytes of str, and a null terminator, to the end of
+ * the capability table provided to it, whose size is updated. It returns the
+ * string's offset.
+ */
+static uint32_t termdb_add(struct termdb** db, size_t* size, const char* str,
+                           size_t len)
+{
+    *db = (struct termdb*) realloc(*db, *size + len + 1);
+    memcpy((char*) *db + *size, str, len);
+    ((char*) *db)[*size + len] = '\0';
+    *size += len + 1;
+    return (uint32_t) (*size - len - 1);
+}
+
+/**
+ * This function builds a capability table from the capabilities and number
+ * of colours provided, working out each colour's sequence in advance.
+ */
+static struct termdb* build_termdb(const char** caps, int colours)
+{
+    struct termdb* db;          /* The table. */
+    char seq[TERMDB_SEQ_MAX];   /* A worked out sequence. */
+    size_t size;                /* The size of the table so far. */
+    size_t len;                 /* The length of a string. */
+    uint32_t off;               /* Where a string was added. */
+    int i;                      /* The current capability or colour. */
+
+    size = sizeof(struct termdb);
+    db = (struct termdb*) calloc(1, size);
+    for (i = 0; i < NUM_CAPS; i++)
+        if (caps[i])
+        {
+            off = termdb_add(&db, &size, caps[i], strlen(caps[i]));
+            db->caps[i] = off;
+        }
+
+    /* Working out the colour sequences. */
+    if (colours < 0 || colours > TERMDB_COLOURS)
+        colours = TERMDB_COLOURS;
+    for (i = 0; i < colours; i++)
+    {
+        if (caps[CAP_SETAF])
+        {
+            len = cap_param(seq, sizeof(seq), caps[CAP_SETAF], i, 0);
+            off = termdb_add(&db, &size, seq, len);
+            db->fg[i] = off;
+        }
+        if (caps[CAP_SETAB])
+        {
+            len = cap_param(seq, sizeof(seq), caps[CAP_SETAB], i, 0);
+            off = termdb_add(&db, &size, seq, len);
+            db->bg[i] = off;
+        }
+    }
+
+    db->magic = TERMDB_MAGIC;
+    db->size = size;
+    return db;
+}
+
+/**
+ * This function puts the path of the capability cache file for the terminal
+ * named term in path. It returns false if there's nowhere to put it.
+ */
+static bool termdb_path(const char* term, char* path, size_t size)
+{
+    char* dir;  /* The cache directory. */
+    char* p;    /* The current character of the file name. */
+
+    if ((dir = getenv("XDG_CACHE_HOME")) && *dir)
+        snprintf(path, size, "%s", dir);
+    else if ((dir = getenv("HOME")) && *dir)
+        snprintf(path, size, "%s/.cache", dir);
+    else
+        return false;
+    mkdir(path, 0700);
+    snprintf(path + strlen(path), size - strlen(path), "/mycutils");
+    mkdir(path, 0700);
+
+    /* Keeping the terminal's name from leaving the directory. */
+    p = path + strlen(path) + strlen("/terminfo-");
+    snprintf(path + strlen(path), size - strlen(path), "/terminfo-%s", term);
+    for (; *p; p++)
+        if (*p == '/')
+            *p = '_';
+    return true;
+}
+
+/**
+ * This function maps the capability cache file at path if it was built from
+ * the terminfo entry at tipath with the details in st, returning NULL if it
+ * wasn't.
+ */
+static const struct termdb* map_termdb(const char* path, const char* tipath,
+                                       struct stat* st)
+{
+    struct termdb* db;  /* The table. */
+    struct stat cst;    /* The cache file's details. */
+    int fd;             /* The cache file's file descriptor. */
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return NULL;
+    if (fstat(fd, &cst) == -1 || cst.st_size < (off_t) sizeof(struct termdb)
+        || (db = (struct termdb*) mmap(NULL, cst.st_size, PROT_READ, 
+                                       MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    /* Checking it is whole and still matches the terminfo entry. */
+    if (db->magic != TERMDB_MAGIC || db->size != (uint64_t) cst.st_size ||
+        db->mtime_sec != st->st_mtim.tv_sec || 
+        db->mtime_nsec != st->st_mtim.tv_nsec ||
+        db->tisize != st->st_size || 
+        strncmp(db->path, tipath, TERMDB_PATH_MAX) != 0)
+    {
+        munmap(db, cst.st_size);
+        return NULL;
+    }
+    return db;
+}
+
+/**
+ * This function finds the capability table of the terminal named by $TERM.
+ * It maps the table from the cache file if the terminfo entry hasn't
+ * changed since it was written, and otherwise reads the entry and rewrites
+ * the cache file. Without an entry, ANSI sequences are used.
+ */
+static void termdb_init()
+{
+    const char* caps[NUM_CAPS];                 /* The capabilities. */
+    char pool[TERMDB_PATH_MAX * NUM_CAPS];      /* Their strings. */
+    char tipath[TERMDB_PATH_MAX];               /* The terminfo path. */
+    char path[TERMDB_PATH_MAX + 64];            /* The cache file path. */
+    char* tmpname;                              /* The new cache file. */
+    struct termdb* db;                          /* The table built. */
+    struct stat st;                             /* The entry's details. */
+    char* term;                                 /* The terminal's name. */
+    int nums[3];                                /* Colours, cols, lines. */
+    int fd;                                     /* The new cache file. */
+
+    term = getenv("TERM");
+    if (term && *term && find_terminfo(term, tipath, &st))
+    {
+        /* Using the cache file if it is up to date. */
+        if (termdb_path(term, path, sizeof(path)) &&
+            (termdb = map_termdb(path, tipath, &st)))
+            return;
+
+        if (read_terminfo(tipath, caps, nums, pool))
+        {
+            db = build_termdb(caps, nums[0]);
+            db->cols = nums[1] > 0 ? nums[1] : -1;
+            db->lines = nums[2] > 0 ? nums[2] : -1;
+            db->mtime_sec = st.st_mtim.tv_sec;
+            db->mtime_nsec = st.st_mtim.tv_nsec;
+            db->tisize = st.st_size;
+            snprintf(db->path, TERMDB_PATH_MAX, "%s", tipath);
+            termdb = db;
+
+            /* Replacing the cache file, so readers see all or none of it. */
+            if (termdb_path(term, path, sizeof(path)))
+            {
+                strfmt(&tmpname, "%s.XXXXXX", path);
+                if ((fd = mkstemp(tmpname)) != -1)
+                {
+                    if (write_all(fd, (const char*) db, db->size) &&
+                        rename(tmpname, path) == 0)
+                        tmpname[0] = '\0';
+                    close(fd);
+                    if (tmpname[0])
+                        unlink(tmpname);
+                }
+                free(tmpname);
+            }
+            return;
+        }
+    }
+
+    /* Falling back to ANSI sequences. */
+    memcpy(caps, cap_ansi, sizeof(caps));
+    db = build_termdb(caps, 8);
+    db->cols = db->lines = -1;
+    termdb = db;
+}
+
+/**
+ * This function returns the capability provided to it, or NULL if the
+ * terminal doesn't have it.
+ */
+static const char* term_capstr(enum termcaps cap)
+{
+    pthread_once(&termdb_once, termdb_init);
+    return termdb->caps[cap] ? (const char*) termdb + termdb->caps[cap] 
+                             : NULL;
+}
+
+/**
+ * This function adds the capability provided to it to the terminal output
+ * buffer, with the parameters p1 and p2 if it takes any.
+ */
+static void term_cap(enum termcaps cap, int p1, int p2)
+{
+    char seq[TERMDB_SEQ_MAX];   /* The worked out sequence. */
+    const char* s;              /* The capability. */
+
+    if (!(s = term_capstr(cap)))
+        return;
+    if (strchr(s, '%') || strstr(s, "$<"))
+        term_put(seq, cap_param(seq, sizeof(seq), s, p1, p2));
+    else
+        term_put(s, strlen(s));
+}
+
+/**
+ * This function adds the sequence that sets the foreground colour, or the
+ * background colour if bg is true, to the terminal output buffer.
+ */
+static void term_colour(int c, bool bg)
+{
+    uint32_t off;   /* The sequence's offset. */
+
+    pthread_once(&termdb_once, termdb_init);
+    if (c < 0 || c >= TERMDB_COLOURS)
+        return;
+    if ((off = bg ? termdb->bg[c] : termdb->fg[c]))
+        term_put((const char*) termdb + off, 
+                 strlen((const char*) termdb + off));
+}
+
+/**
+ * This function adds the sequence that moves the cursor to the column and
+ * row provided to the terminal output buffer.
+ */
+static void term_cup(int col, int row)
+{
+    term_cap(CAP_CUP, row, col);
+}
+
+/**
+ * This function clears the entire terminal and positions the cursor at home.
+ */
+MYCUTILS_API void clear()
+{
+    /* Clearing the terminal and putting the cursor at home. */
+    term_cap(CAP_CLEAR, 0, 0);
+    term_flush();
+}
+
+/**
+ * This function clears the current line the terminal cursor is on from
+ * the position of the cursor to the line's beginning.
+ */
+MYCUTILS_API void clearb()
+{
+    /* Clearing from the cursor to the beginning of the line. */
+    term_cap(CAP_EL1, 0, 0);
+    term_flush();
+}
+
+/**
+ * This function clears the current line the terminal cursor is on from
+ * the position of the cursor to the line's end.
+ */
+MYCUTILS_API void clearf()
+{
+    /* Clearing from the cursor to the end of the line. */
+    term_cap(CAP_EL, 0, 0);
+    term_flush();
+}
+
+/**
+ * This function clears the entire line that the terminal cursor is currently
+ * on.
+ */
+MYCUTILS_API void clearfb()
+{
+    /* Clearing the line that the terminal cursor is currently on. */
+    clearf();
+    clearb();
+}
+
+/**
+ * This function returns the number of rows and columns of the terminal. If
+ * standard output isn't a terminal, the size in its terminfo entry is used,
+ * or 0 if it has none.
+ */
+MYCUTILS_API vec2d get_res()
+{
+    struct winsize ws;  /* The terminal's size. */
+    vec2d res;          /* Storage for the rows and columns. */
+
+    /* Asking the terminal. */
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && 
+        ws.ws_row > 0)
+    {
+        res.x = ws.ws_col;
+        res.y = ws.ws_row;
+        return res;
+    }
+
+    /* Falling back to the terminfo entry. */
+    pthread_once(&termdb_once, termdb_init);
+    res.x = termdb->cols > 0 ? termdb->cols : 0;
+    res.y = termdb->lines > 0 ? termdb->lines : 0;
+    return res;
+}
+
+/**
+ * This function moves the terminal cursor a number of rows or columns
+ * equal to the number provided to the function, and in a direction that is
+ * also provided.
+ */
+MYCUTILS_API void move_cursor(enum directions direction, unsigned int n)
+{
+    /* Moving the cursor. */
+    switch (direction)
+    {
+        case ABOVE:
+            term_cap(CAP_CUU, n, 0);
+            break;
+        case BELOW:
+            term_cap(CAP_CUD, n, 0);
+            break;
+        case BEFORE:
+            term_cap(CAP_CUB, n, 0);
+            break;
+        case AFTER:
+            term_cap(CAP_CUF, n, 0);
+            break;
+    }
+    term_flush();
+}
+
+/**
+ * This function prints the text file at the file path provided to it. It
+ * prints the text file in the colours and mode that are provided to
+ * the function.
+ */
+MYCUTILS_API void print_fs_mod(char* filepath, vec2d origin,
+                               enum termcolours colour, enum textmodes mode)
+{
+    FILE* fs;   /* Pointer to the file stream. */
+    char* line; /* The text in the file. */
+
+    /* Ensuring that the buffer is set to NULL. */
+    line = NULL;
+    
+    /* Opening the file. */ 
+    fs = openfs(filepath, "r");
+
+    /* Setting the text mode and foreground colour. */
+    text_mode(mode);
+    text_fcol(colour);
+
+    /* Reading the line from the file. */ 
+    while (readfsl(fs, &line)) 
+    {
+        /* Dropping the newline, since each line is positioned itself. */
+        line[strcspn(line, "\n")] = '\0';
+
+        /* Drawing the line. */
+        print_str(line, origin);
+
+        /* Getting ready to draw the next line. */
+        origin.y++;
+        free(line);
+        line = NULL;
+    }
+
+    /* Changing the text-mode and colour back to normal. */
+    text_mode(NORMAL);
+
+    /* Closing the file. */
+    closefs(fs);
+}
+
+/**
+ * This function prints the string provided to it at the position that is
+ * also provided to the function.
+ */
+MYCUTILS_API void print_str(char* str, vec2d pos)
+{
+    print_strn(str, strlen(str), pos);
+}
+
+/**
+ * This function prints len chars of the string provided to it at the
+ * position that is also provided to the function, in the same way as
+ * print_str().
+ */
+MYCUTILS_API void print_strn(const char* str, size_t len, vec2d pos)
+{
+    PROBE3(print_str_entry, len, pos.x, pos.y);
+
+    /* Positioning the cursor. */
+    term_cup(pos.x, pos.y);
+
+    /* Printing the string. */
+    term_text(str, len);
+    term_flush();
+
+    PROBE1(print_str_return, len);
+}
+
+/**
+ * This function prints the string provided to it at the position
+ * that is also provided. It prints the string in the colours and in the
+ * mode provided.
+ */
+MYCUTILS_API void print_str_mod(char* str, vec2d pos, enum termcolours fcol,
+                                enum textmodes mode)
+{
+    /* Setting the text mode and foreground colour. */
+    text_mode(mode);
+    text_fcol(fcol);
+
+    /* Printing the string. */
+    print_str(str, pos);
+
+    /* Reverting changes to the textcolours and mode. */
+    text_mode(NORMAL);
+}
+
+
+/**
+ * This is one line of a wrapped string.
+ */
+typedef struct {
+    size_t start;   /* The offset of the line in the expanded text. */
+    size_t len;     /* The length of the line in bytes. */
+    int cols;       /* The width of the line in columns. */
+} layline;
+
+/**
+ * This is a wrapped string, remembered in the layout cache.
+ */
+typedef struct {
+    uint64_t hash;  /* The hash of the string's contents. */
+    char* str;      /* The string, to check hits against. */
+    size_t len;     /* The length of the string. */
+    int width;      /* The width it was wrapped to. */
+    int mode;       /* How it was wrapped. */
+    char* text;     /* The string with its tabs expanded. */
+    layline* lines; /* Its lines. */
+    size_t nlines;  /* The number of lines. */
+} layout;
+
+/**
+ * This is a word of a paragraph being wrapped.
+ */
+typedef struct {
+    size_t start;   /* The offset of the word. */
+    size_t end;     /* The offset after the word. */
+    int cstart;     /* The column the word starts at. */
+    int cend;       /* The column after the word. */
+} layword;
+
+/**
+ * The layout cache holds each wrapped string in the slot chosen by its
+ * hash, replacing whatever was there. Each thread has its own, so a layout
+ * can't be replaced while another thread prints it, and it is freed when
+ * the thread exits.
+ */
+static __thread layout* layout_cache[LAYOUT_CACHE_SIZE];
+static pthread_key_t layout_key;
+static pthread_once_t layout_once = PTHREAD_ONCE_INIT;
+
+/**
+ * This function frees the layout provided to it.
+ */
+static void free_layout(layout* l)
+{
+    free(l->str);
+    free(l->text);
+    free(l->lines);
+    free(l);
+}
+
+/**
+ * This function frees the layout cache provided to it, when the thread
+ * that owns it exits.
+ */
+static void layout_cache_free(void* cache)
+{
+    size_t slot;    /* The current slot. */
+
+    for (slot = 0; slot < LAYOUT_CACHE_SIZE; slot++)
+    {
+        if (((layout**) cache)[slot] != NULL)
+            free_layout(((layout**) cache)[slot]);
+        ((layout**) cache)[slot] = NULL;
+    }
+}
+
+/**
+ * This function creates the key that has each thread's layout cache freed
+ * when the thread exits.
+ */
+static void layout_init()
+{
+    pthread_key_create(&layout_key, layout_cache_free);
+}
+
+/**
+ * This function returns a 64 bit FNV-1a hash of the len bytes at p.
+ */
+static uint64_t hash_bytes(const char* p, size_t len)
+{
+    uint64_t h;     /* The hash. */
+    size_t i;       /* Index of the current byte. */
+
+    h = 14695981039346656037ULL;
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char) p[i]) * 1099511628211ULL;
+    return h;
+}
+
+/**
+ * This function returns whether the byte provided to it starts a UTF-8
+ * character, so counts as a column.
+ */
+static inline bool is_col(char c)
+{
+    return ((unsigned char) c & 0xC0) != 0x80;
+}
+
+/**
+ * This function returns the number of columns the byte provided to it takes
+ * up when printed by term_text(), where control characters take two.
+ */
+static inline int byte_cols(char c)
+{
+    return in_class(c, CLASS_CONTROL) ? 2 : is_col(c);
+}
+
+/**
+ * This function returns a copy of the string provided to it with its tabs
+ * replaced by spaces up to the next tab stop.
+ */
+static char* expand_tabs(const char* str, size_t len)
+{
+    char* out;      /* The expanded string. */
+    size_t tabs;    /* The number of tabs. */
+    size_t i;       /* Index of the current byte of the string. */
+    size_t o;       /* Index of the current byte of the copy. */
+    int col;        /* The current column. */
+
+    /* Allocating room for the widest each tab could be. */
+    for (tabs = 0, i = 0; i < len; i++)
+        tabs += str[i] == '\t';
+    out = (char*) malloc(len + tabs * (TAB_WIDTH - 1) + 1);
+
+    for (i = 0, o = 0, col = 0; i < len; i++)
+    {
+        if (str[i] == '\t')
+        {
+            do
+                out[o++] = ' ';
+            while (++col % TAB_WIDTH != 0);
+            continue;
+        }
+        out[o++] = str[i];
+        col = str[i] == '\n' ? 0 : col + byte_cols(str[i]);
+    }
+    out[o] = '\0';
+    return out;
+}
+
+/**
+ * This function adds a line covering words i to j of a paragraph to the
+ * layout provided to it.
+ */
+static void layout_add(layout* l, size_t* cap, layword* words, 
+                       size_t i, size_t j)
+{
+    if (l->nlines == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 8;
+        l->lines = (layline*) realloc(l->lines, sizeof(layline) * *cap);
+    }
+    l->lines[l->nlines].start = words[i].start;
+    l->lines[l->nlines].len = words[j].end - words[i].start;
+    l->lines[l->nlines].cols = words[j].cend - words[i].cstart;
+    l->nlines++;
+}
+
+/**
+ * This function wraps the n words of a paragraph into lines of the layout
+ * provided to it. Greedy wrapping fills each line in turn. Optimal wrapping
+ * chooses the breaks that minimise the sum of the squares of the space left
+ * on every line but the last.
+ */
+static void layout_para(layout* l, size_t* cap, layword* words, size_t n)
+{
+    double* cost;   /* The least cost of laying out words from i on. */
+    size_t* brk;    /* The last word on the first line of that layout. */
+    double c;       /* The cost of a candidate layout. */
+    int slack;      /* The space left on a line. */
+    size_t i;       /* The first word on a line. */
+    size_t j;       /* The last word on a line. */
+
+    if (l->mode == WRAP_GREEDY)
+    {
+        for (i = 0; i < n; i = j + 1)
+            for (j = i; ; j++)
+                if (j + 1 == n || words[j + 1].cend - words[i].cstart > l->width)
+                {
+                    layout_add(l, cap, words, i, j);
+                    break;
+                }
+        return;
+    }
+
+    /* Working backwards, finding the best layout of each suffix. */
+    cost = (double*) malloc(sizeof(double) * (n + 1));
+    brk = (size_t*) malloc(sizeof(size_t) * n);
+    cost[n] = 0;
+    for (i = n; i-- > 0; )
+    {
+        cost[i] = -1;
+        for (j = i; j < n; j++)
+        {
+            if ((slack = l->width - (words[j].cend - words[i].cstart)) < 0 && 
+                j > i)
+                break;
+            c = (j + 1 == n ? 0 : (double) slack * slack) + cost[j + 1];
+            if (cost[i] < 0 || c < cost[i])
+            {
+                cost[i] = c;
+                brk[i] = j;
+            }
+        }
+    }
+
+    /* Following the best breaks. */
+    for (i = 0; i < n; i = brk[i] + 1)
+        layout_add(l, cap, words, i, brk[i]);
+
+    free(cost);
+    free(brk);
+}
+
+/**
+ * This function wraps the string provided to it, or finds it in the layout
+ * cache if it has been wrapped the same way before.
+ */
+static layout* get_layout(char* str, int width, enum wrapmodes mode)
+{
+    layout* l;      /* The layout. */
+    layword* words; /* The words of the current paragraph. */
+    size_t nwords;  /* The number of words. */
+    size_t wcap;    /* The allocated number of words. */
+    size_t cap;     /* The allocated number of lines. */
+    size_t len;     /* The length of the string. */
+    uint64_t hash;  /* The hash of the string. */
+    size_t slot;    /* The string's slot in the cache. */
+    size_t p;       /* The start of the current paragraph. */
+    size_t i;       /* Index of the current byte. */
+    int col;        /* The current column. */
+    int wcol;       /* The columns in the current piece of a word. */
+
+    if (width < 1)
+        width = 1;
+
+    /* Looking in the cache. The hash only picks the slot and rules out most
+     * misses, since different strings can share a hash, so the string
+     * itself is compared before the layout is used. */
+    len = strlen(str);
+    hash = hash_bytes(str, len);
+    slot = (hash ^ (hash >> 32) ^ width ^ mode) % LAYOUT_CACHE_SIZE;
+    if ((l = layout_cache[slot]) != NULL && l->hash == hash && 
+        l->len == len && l->width == width && l->mode == (int) mode &&
+        memcmp(l->str, str, len) == 0)
+        return l;
+
+    /* Replacing whatever was in the slot, and making sure the cache is freed
+     * with the thread. */
+    if (l != NULL)
+        free_layout(l);
+    else
+    {
+        pthread_once(&layout_once, layout_init);
+        pthread_setspecific(layout_key, layout_cache);
+    }
+    l = layout_cache[slot] = (layout*) calloc(1, sizeof(layout));
+    l->hash = hash;
+    l->str = (char*) malloc(len + 1);
+    memcpy(l->str, str, len + 1);
+    l->len = len;
+    l->width = width;
+    l->mode = mode;
+    l->text = expand_tabs(str, len);
+    len = strlen(l->text);
+
+    words = NULL;
+    wcap = 0;
+    cap = 0;
+    for (p = 0; p <= len; p = i + 1)
+    {
+        /* Splitting the paragraph into words. Words wider than a line are
+         * split into pieces that fit. */
+        nwords = 0;
+        col = 0;
+        for (i = p; i < len && l->text[i] != '\n'; )
+        {
+            if (l->text[i] == ' ')
+            {
+                col++;
+                i++;
+                continue;
+            }
+            if (nwords == wcap)
+            {
+                wcap = wcap ? wcap * 2 : 32;
+                words = (layword*) realloc(words, sizeof(layword) * wcap);
+            }
+            words[nwords].start = i;
+            words[nwords].cstart = col;
+            for (wcol = 0; i < len && l->text[i] != ' ' && 
+                           l->text[i] != '\n'; i++)
+            {
+                if (wcol > 0 && wcol + byte_cols(l->text[i]) > width)
+                    break;
+                wcol += byte_cols(l->text[i]);
+                col += byte_cols(l->text[i]);
+            }
+            words[nwords].end = i;
+            words[nwords].cend = col;
+            nwords++;
+        }
+
+        /* Wrapping the paragraph. An empty one is one empty line. */
+        if (nwords == 0)
+        {
+            if (nwords == wcap)
+            {
+                wcap = 32;
+                words = (layword*) realloc(words, sizeof(layword) * wcap);
+            }
+            words[0].start = words[0].end = p;
+            words[0].cstart = words[0].cend = 0;
+            nwords = 1;
+        }
+        layout_para(l, &cap, words, nwords);
+    }
+
+    free(words);
+    return l;
+}
+
+/**
+ * This function returns the number of lines the string provided to it
+ * needs when wrapped to width columns.
+ */
+MYCUTILS_API int wrapped_lines(char* str, int width, enum wrapmodes mode)
+{
+    return get_layout(str, width, mode)->nlines;
+}
+
+/**
+ * This function prints the string provided to it wrapped to width columns,
+ * with its first line at the position provided. Tabs are expanded, lines
+ * are aligned as asked, and if maxlines is not 0 and the string needs more
+ * lines, the last line printed ends with "...". Line breaks are remembered
+ * by the string's contents and width, so printing the same string again
+ * costs no layout work. It returns the number of lines printed.
+ */
+MYCUTILS_API int print_wrapped(char* str, vec2d pos, int width, int maxlines,
+                               enum alignments align, enum wrapmodes mode)
+{
+    const int ELLIPSIS = 3;     /* The width of "...". */
+    layout* l;                  /* The wrapped string. */
+    layline* line;              /* The current line. */
+    size_t shown;               /* The number of lines printed. */
+    size_t len;                 /* The bytes of the line printed. */
+    size_t i;                   /* Index of the current line. */
+    bool cut;                   /* Whether the line ends with "...". */
+    int cols;                   /* The columns of the line printed. */
+    int indent;                 /* The columns before the line. */
+
+    l = get_layout(str, width, mode);
+    shown = maxlines > 0 && (size_t) maxlines < l->nlines ? 
+            (size_t) maxlines : l->nlines;
+
+    for (i = 0; i < shown; i++)
+    {
+        line = &l->lines[i];
+        len = line->len;
+        cols = line->cols;
+
+        /* Making room for "..." on the last line if lines are left out. */
+        cut = i + 1 == shown && shown < l->nlines;
+        if (cut)
+        {
+            while (len > 0 && cols > l->width - ELLIPSIS)
+                cols -= byte_cols(l->text[line->start + --len]);
+            cols += ELLIPSIS;
+        }
+
+        /* Aligning the line. */
+        indent = align == ALIGN_LEFT ? 0 : l->width - cols;
+        if (align == ALIGN_CENTRE)
+            indent /= 2;
+
+        /* Printing the line. */
+        term_cup(pos.x + (indent > 0 ? indent : 0), pos.y + i);
+        term_text(l->text + line->start, len);
+        if (cut)
+            term_put("...", ELLIPSIS);
+    }
+    term_flush();
+
+    return shown;
+}
+
+/**
+ * This marks a cell or pixel that has no colour.
+ */
+#define NO_COLOUR 0xFF
+
+/**
+ * This is a canvas. Braille canvases keep a dot mask and one colour per
+ * cell, and half-block canvases keep a colour per pixel.
+ */
+struct canvas {
+    enum canvasmodes mode;  /* How pixels map onto cells. */
+    int cols;               /* The width in cells. */
+    int rows;               /* The height in cells. */
+    int w;                  /* The width in pixels. */
+    int h;                  /* The height in pixels. */
+    uint8_t* dots;          /* The dot mask of each Braille cell. */
+    uint8_t* colours;       /* The colour of each cell or pixel. */
+};
+
+/**
+ * This is the bit of a Braille cell's dot mask for each pixel of the cell,
+ * by row then column.
+ */
+static const uint8_t BRAILLE_BITS[4][2] = {
+    { 0x01, 0x08 },
+    { 0x02, 0x10 },
+    { 0x04, 0x20 },
+    { 0x40, 0x80 }
+    };
+
+/**
+ * This function returns the number of colours the canvas provided to it
+ * keeps. Braille canvases keep one for each cell and others one for each
+ * pixel.
+ */
+static size_t canvas_colours(canvas* cv)
+{
+    return cv->mode == CANVAS_BRAILLE ? 
+           (size_t) cv->cols * cv->rows : (size_t) cv->w * cv->h;
+}
+
+/**
+ * This function creates a blank canvas that covers cols columns and rows rows
+ * of the terminal.
+ */
+MYCUTILS_API canvas* new_canvas(int cols, int rows, enum canvasmodes mode)
+{
+    canvas* cv;     /* The canvas. */
+
+    cv = (canvas*) malloc(sizeof(canvas));
+    cv->mode = mode;
+    cv->cols = cols;
+    cv->rows = rows;
+    cv->w = mode == CANVAS_BRAILLE ? cols * 2 : cols;
+    cv->h = mode == CANVAS_BRAILLE ? rows * 4 : rows * 2;
+    cv->dots = (uint8_t*) malloc(cols * rows);
+    cv->colours = (uint8_t*) malloc(canvas_colours(cv));
+    canvas_clear(cv);
+    return cv;
+}
+
+/**
+ * This function returns the size of the canvas provided to it in pixels.
+ */
+MYCUTILS_API vec2d canvas_res(canvas* cv)
+{
+    vec2d res;  /* The size. */
+
+    res.x = cv->w;
+    res.y = cv->h;
+    return res;
+}
+
+/**
+ * This function clears every pixel of the canvas provided to it.
+ */
+MYCUTILS_API void canvas_clear(canvas* cv)
+{
+    memset(cv->dots, 0, cv->cols * cv->rows);
+    memset(cv->colours, NO_COLOUR, canvas_colours(cv));
+}
+
+/**
+ * This function sets the pixel at x, y of the canvas provided to it to the
+ * colour provided. Pixels off the canvas are ignored.
+ */
+MYCUTILS_API void canvas_set(canvas* cv, int x, int y, enum termcolours c)
+{
+    size_t cell;    /* The index of the pixel's cell. */
+
+    if ((unsigned) x >= (unsigned) cv->w || (unsigned) y >= (unsigned) cv->h)
+        return;
+
+    if (cv->mode == CANVAS_BRAILLE)
+    {
+        cell = (size_t) (y >> 2) * cv->cols + (x >> 1);
+        cv->dots[cell] |= BRAILLE_BITS[y & 3][x & 1];
+        cv->colours[cell] = c;
+    }
+    else
+        cv->colours[(size_t) y * cv->w + x] = c;
+}
+
+/**
+ * This function draws a line between two pixels of the canvas provided to
+ * it.
+ */
+MYCUTILS_API void canvas_line(canvas* cv, int x0, int y0, int x1, int y1,
+                              enum termcolours c)
+{
+    int dx;     /* The distance across. */
+    int dy;     /* The negated distance down. */
+    int sx;     /* The step across. */
+    int sy;     /* The step down. */
+    int err;    /* The accumulated error. */
+
+    /* Stepping along the line with Bresenham's algorithm. */
+    dx = abs(x1 - x0);
+    dy = -abs(y1 - y0);
+    sx = x0 < x1 ? 1 : -1;
+    sy = y0 < y1 ? 1 : -1;
+    err = dx + dy;
+    for (;;)
+    {
+        canvas_set(cv, x0, y0, c);
+        if (x0 == x1 && y0 == y1)
+            return;
+        if (2 * err >= dy)
+        {
+            err += dy;
+            x0 += sx;
+        }
+        if (2 * err <= dx)
+        {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+/**
+ * This function plots n points, whose coordinates are in xs and ys, on the
+ * canvas provided to it. The ranges provided are mapped onto the whole
+ * canvas, with y increasing upwards, and points outside them are left out.
+ * A range with no width is centred on the canvas. If joined is true, lines
+ * are drawn between consecutive points.
+ */
+MYCUTILS_API void canvas_plot(canvas* cv, const double* xs, const double* ys,
+                              size_t n, double xmin, double xmax, double ymin,
+                              double ymax, enum termcolours c, bool joined)
+{
+    double sx;      /* The pixels per unit across. */
+    double sy;      /* The pixels per unit down. */
+    double cx;      /* The centre column. */
+    double cy;      /* The centre row. */
+    bool prev;      /* Whether the previous point was plotted. */
+    int px;         /* The previous point's column. */
+    int py;         /* The previous point's row. */
+    int x;          /* The current point's column. */
+    int y;          /* The current point's row. */
+    size_t i;       /* Index of the current point. */
+
+    /* Working out the mapping once rather than calling map() per point. A
+     * range with no width, such as that of a single point or a flat series,
+     * can't be scaled, so its points are centred instead. */
+    sx = xmax > xmin && isfinite(xmax - xmin) ? 
+         (cv->w - 1) / (xmax - xmin) : 0;
+    sy = ymax > ymin && isfinite(ymax - ymin) ? 
+         (cv->h - 1) / (ymin - ymax) : 0;
+    cx = (cv->w - 1) / 2.0;
+    cy = (cv->h - 1) / 2.0;
+
+    prev = false;
+    px = py = 0;
+    for (i = 0; i < n; i++)
+    {
+        /* Leaving out points outside the ranges. */
+        if (!(xs[i] >= xmin && xs[i] <= xmax && 
+              ys[i] >= ymin && ys[i] <= ymax))
+        {
+            prev = false;
+            continue;
+        }
+
+        /* Plotting the point, or joining it to the previous one. */
+        x = (int) ((sx != 0 ? (xs[i] - xmin) * sx : cx) + 0.5);
+        y = (int) ((sy != 0 ? (ys[i] - ymax) * sy : cy) + 0.5);
+        if (joined && prev)
+            canvas_line(cv, px, py, x, y, c);
+        else
+            canvas_set(cv, x, y, c);
+        prev = true;
+        px = x;
+        py = y;
+    }
+}
+
+/**
+ * This function adds the sequences that set the foreground and background
+ * colours to the terminal output buffer, if they aren't set already.
+ */
+static void term_colours(int fg, int bg, int* cur_fg, int* cur_bg)
+{
+    /* Terminals can only put both colours back at once, so the other one is
+     * set again afterwards if it is still needed. */
+    if ((fg == NO_COLOUR && *cur_fg != NO_COLOUR) || 
+        (bg == NO_COLOUR && *cur_bg != NO_COLOUR))
+    {
+        term_cap(CAP_OP, 0, 0);
+        *cur_fg = *cur_bg = NO_COLOUR;
+    }
+    if (fg != *cur_fg)
+    {
+        term_colour(fg, false);
+        *cur_fg = fg;
+    }
+    if (bg != *cur_bg)
+    {
+        term_colour(bg, true);
+        *cur_bg = bg;
+    }
+}
+
+/**
+ * This function prints the canvas provided to it with its top left cell at
+ * the position provided.
+ */
+MYCUTILS_API void print_canvas(canvas* cv, vec2d pos)
+{
+    char glyph[3];  /* The UTF-8 of a Braille glyph. */
+    uint8_t dots;   /* The dots of a Braille cell. */
+    int top;        /* The colour of the top pixel of a half block. */
+    int bottom;     /* The colour of the bottom pixel of a half block. */
+    int fg;         /* The foreground colour in use. */
+    int bg;         /* The background colour in use. */
+    int row;        /* The current row of cells. */
+    int col;        /* The current column of cells. */
+
+    fg = bg = NO_COLOUR;
+    for (row = 0; row < cv->rows; row++)
+    {
+        term_cup(pos.x, pos.y + row);
+        for (col = 0; col < cv->cols; col++)
+        {
+            if (cv->mode == CANVAS_BRAILLE)
+            {
+                /* Braille glyphs are U+2800 plus the dot mask. */
+                dots = cv->dots[row * cv->cols + col];
+                term_colours(dots ? cv->colours[row * cv->cols + col] : fg, 
+                             NO_COLOUR, &fg, &bg);
+                glyph[0] = (char) 0xE2;
+                glyph[1] = (char) (0xA0 | dots >> 6);
+                glyph[2] = (char) (0x80 | (dots & 0x3F));
+                term_put(glyph, 3);
+                continue;
+            }
+
+            /* Using the upper half block with the top pixel's colour in
+             * front of the bottom pixel's colour, or the lower half block
+             * if only the bottom pixel is set. */
+            top = cv->colours[(size_t) row * 2 * cv->w + col];
+            bottom = cv->colours[(size_t) (row * 2 + 1) * cv->w + col];
+            if (top == NO_COLOUR && bottom == NO_COLOUR)
+            {
+                term_colours(fg, NO_COLOUR, &fg, &bg);
+                term_put(" ", 1);
+            }
+            else if (top == NO_COLOUR)
+            {
+                term_colours(bottom, NO_COLOUR, &fg, &bg);
+                term_put("\xE2\x96\x84", 3);
+            }
+            else
+            {
+                term_colours(top, bottom, &fg, &bg);
+                term_put("\xE2\x96\x80", 3);
+            }
+        }
+    }
+
+    /* Putting the colours back. */
+    term_colours(NO_COLOUR, NO_COLOUR, &fg, &bg);
+    term_flush();
+}
+
+/**
+ * This function frees the canvas provided to it.
+ */
+MYCUTILS_API void free_canvas(canvas* cv)
+{
+    free(cv->dots);
+    free(cv->colours);
+    free(cv);
+}
+
+/**
+ * This is a table. Only its column widths and scroll position are kept;
+ * cells are asked for when they are printed.
+ */
+struct table {
+    size_t nrows;       /* The number of rows. */
+    size_t ncols;       /* The number of columns. */
+    char** headers;     /* The column headers. */
+    int* widths;        /* The width of each column. */
+    table_cb cell;      /* Provides the text of each cell. */
+    void* arg;          /* The cell callback's argument. */
+    size_t row;         /* The first row shown. */
+    size_t col;         /* The first column shown. */
+};
+
+/**
+ * This function returns the number of columns the string provided to it
+ * takes up.
+ */
+static int str_cols(const char* str)
+{
+    int cols;   /* The number of columns. */
+
+    for (cols = 0; *str; str++)
+        cols += byte_cols(*str);
+    return cols;
+}
+
+/**
+ * This function creates a table of nrows rows and ncols columns, headed by
+ * the strings in headers, whose cells are provided by the callback cell.
+ * Column widths are worked out once from the headers and a sample of the
+ * rows.
+ */
+MYCUTILS_API table* new_table(size_t nrows, size_t ncols, char** headers,
+                              table_cb cell, void* arg)
+{
+    table* t;       /* The table. */
+    size_t step;    /* The distance between sampled rows. */
+    size_t r;       /* The current row. */
+    size_t c;       /* The current column. */
+    int w;          /* The width of a cell. */
+
+    t = (table*) calloc(1, sizeof(table));
+    t->nrows = nrows;
+    t->ncols = ncols;
+    t->cell = cell;
+    t->arg = arg;
+    t->headers = (char**) malloc(sizeof(char*) * ncols);
+    t->widths = (int*) malloc(sizeof(int) * ncols);
+
+    /* Starting each column as wide as its header. */
+    for (c = 0; c < ncols; c++)
+    {
+        strfmt(&t->headers[c], "%s", headers[c]);
+        t->widths[c] = str_cols(headers[c]);
+    }
+
+    /* Widening the columns to fit rows sampled evenly through the table. */
+    step = nrows / TABLE_SAMPLE_ROWS + 1;
+    for (r = 0; r < nrows; r += step)
+        for (c = 0; c < ncols; c++)
+            if ((w = str_cols(cell(r, c, arg))) > t->widths[c])
+                t->widths[c] = w;
+
+    for (c = 0; c < ncols; c++)
+        if (t->widths[c] > TABLE_MAX_WIDTH)
+            t->widths[c] = TABLE_MAX_WIDTH;
+
+    return t;
+}
+
+/**
+ * This function scrolls the table provided to it by the number of rows and
+ * columns provided, stopping at its edges.
+ */
+MYCUTILS_API void table_scroll(table* t, long rows, long cols)
+{
+    if (rows < 0 && (size_t) -rows > t->row)
+        t->row = 0;
+    else
+        t->row += rows;
+    if (t->row >= t->nrows)
+        t->row = t->nrows ? t->nrows - 1 : 0;
+
+    if (cols < 0 && (size_t) -cols > t->col)
+        t->col = 0;
+    else
+        t->col += cols;
+    if (t->col >= t->ncols)
+        t->col = t->ncols ? t->ncols - 1 : 0;
+}
+
+/**
+ * This function adds the text provided to the terminal output buffer, cut
+ * or padded with spaces to exactly width columns.
+ */
+static void term_cell(const char* text, int width)
+{
+    const char* end;    /* The end of the part of the text that fits. */
+    int cols;           /* The columns of the text that fit. */
+
+    /* Finding how much of the text fits. */
+    for (end = text, cols = 0; *end; end++)
+    {
+        if (byte_cols(*end) && cols + byte_cols(*end) > width)
+            break;
+        cols += byte_cols(*end);
+    }
+
+    /* Printing it and padding it out. */
+    term_text(text, end - text);
+    for (; cols < width; cols++)
+        term_put(" ", 1);
+}
+
+/**
+ * This function prints the row of cells provided by the callback, or the
+ * header if header is true, in the columns that fit in width columns. The
+ * line is always padded out to the full width.
+ */
+static void table_line(table* t, size_t row, bool header, int width)
+{
+    const char* text;   /* The text of the current cell. */
+    size_t c;           /* The current column. */
+    int w;              /* The width of the current column. */
+    int used;           /* The columns used so far. */
+
+    for (c = t->col, used = 0; c < t->ncols && used < width; c++)
+    {
+        /* Separating the columns. */
+        if (c > t->col)
+        {
+            term_cell(" | ", width - used < 3 ? width - used : 3);
+            used += 3;
+            if (used >= width)
+                break;
+        }
+
+        /* Printing the cell, cutting it short at the edge of the area. */
+        w = t->widths[c] < width - used ? t->widths[c] : width - used;
+        text = header ? t->headers[c] : t->cell(row, c, t->arg);
+        term_cell(text, w);
+        used += w;
+    }
+
+    /* Clearing the rest of the line, which may still hold text from before
+     * a scroll. */
+    if (used < width)
+        term_cell("", width - used);
+}
+
+/**
+ * This function prints the rows and columns of the table provided to it that
+ * fit in an area of size columns and rows, at the position provided. The
+ * header stays at the top of the area.
+ */
+MYCUTILS_API void print_table(table* t, vec2d pos, vec2d size)
+{
+    int line;   /* The current line of the area. */
+
+    for (line = 0; line < size.y; line++)
+    {
+        term_cup(pos.x, pos.y + line);
+        if (line == 0)
+        {
+            term_cap(CAP_BOLD, 0, 0);
+            table_line(t, 0, true, size.x);
+            term_cap(CAP_SGR0, 0, 0);
+        }
+        else if (t->row + line - 1 < t->nrows)
+            table_line(t, t->row + line - 1, false, size.x);
+        else
+            term_cell("", size.x);
+    }
+    term_flush();
+}
+
+/**
+ * This function frees the table provided to it.
+ */
+MYCUTILS_API void free_table(table* t)
+{
+    size_t c;   /* The current column. */
+
+    for (c = 0; c < t->ncols; c++)
+        free(t->headers[c]);
+    free(t->headers);
+    free(t->widths);
+    free(t);
+}
+
+/**
+ * This function places the terminal at the row and column numbers
+ * provided to it.
+ */
+MYCUTILS_API void put_cursor(unsigned int col, unsigned int row)
+{
+    /* Setting the cursor position. */
+    term_cup(col, row);
+    term_flush();
+}
+
+/**
+ * This function sets the background colour of the terminal cursor.
+ */
+MYCUTILS_API void text_bcol(enum termcolours c)
+{
+    /* Setting the background colour. */
+    term_colour(c, true);
+    term_flush();
+}
+
+/**
+ * This function sets the foreground colour of the temrinal cursor.
+ */
+MYCUTILS_API void text_fcol(enum termcolours c)
+{
+    /* Setting the colour. */
+    term_colour(c, false);
+    term_flush();
 }
 
 /**
  * This function changes the terminal text-mode.
  */
-void text_mode(enum textmodes m)
+MYCUTILS_API void text_mode(enum textmodes m)
 {
     /* Changing the terminal text-mode. */
     switch (m) 
     {
-        case BOLD       : system( "tput bold" ); break;
-        case NORMAL     : system( "tput sgr0" ); break;
-        case BLINK      : system( "tput blink" ); break;
-        case REVERSE    : system( "tput smso" ); break;
-        case UNDERLINE  : system( "tput smul" ); break;
+        case BOLD       : term_cap(CAP_BOLD, 0, 0); break;
+        case NORMAL     : term_cap(CAP_SGR0, 0, 0); break;
+        case BLINK      : term_cap(CAP_BLINK, 0, 0); break;
+        case REVERSE    : term_cap(CAP_SMSO, 0, 0); break;
+        case UNDERLINE  : term_cap(CAP_SMUL, 0, 0); break;
     }
+    term_flush();
 }
@@ -12,6 +12,48 @@
 #ifndef MYCUTILS_H
 #define MYCUTILS_H
 
+/**
+ * The library can be built as a single header. Defining
+ * MYCUTILS_IMPLEMENTATION in one file, before it includes anything else, 
+ * compiles mycutils.c into that file along with this header, so the library
+ * needs no separate build step. Defining MYCUTILS_STATIC as well keeps all 
+ * of the library's functions private to that file.
+ */
+#if defined(MYCUTILS_IMPLEMENTATION) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+/**
+ * This is placed in front of every function of the library. It can be 
+ * defined before this header is included to control the functions' linkage
+ * or visibility, for example as __attribute__((visibility("default"))) when
+ * building a shared library with -fvisibility=hidden.
+ */
+#ifndef MYCUTILS_API
+#ifdef MYCUTILS_STATIC
+#define MYCUTILS_API static __attribute__((unused))
+#else
+#define MYCUTILS_API
+#endif
+#endif
+
+/**
+ * This is placed in front of the few functions that are defined in this
+ * header so their callers can inline them. The file that compiles the 
+ * library gives them ordinary external definitions, so they stay exported
+ * symbols of the library, while every other file only gets a copy to 
+ * inline.
+ */
+#ifndef MYCUTILS_INLINE
+#if defined(MYCUTILS_C) || defined(MYCUTILS_IMPLEMENTATION)
+#define MYCUTILS_INLINE MYCUTILS_API
+#elif defined(__GNUC_GNU_INLINE__) && !defined(__cplusplus)
+#define MYCUTILS_INLINE extern inline
+#else
+#define MYCUTILS_INLINE inline
+#endif
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +64,35 @@
 #include <errno.h>
 #include <unistd.h>
 #include <termios.h>
+#include <ctype.h>
+#include <math.h>
+#include <locale.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sched.h>
+
+/**
+ * USDT probes are placed on the library's hot paths when <sys/sdt.h> is 
+ * available. Define MYCUTILS_NO_PROBES to leave them out.
+ */
+#if !defined(MYCUTILS_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MYCUTILS_HAVE_PROBES
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
  * This is the number of nanoseconds in a second.
@@ -38,30 +109,62 @@ typedef struct {
 /******************************** Maths **************************************/
 
 /**
- * This function maps value x to a value within a desired range.
+ * This function maps value x to a value within a desired range. It is 
+ * defined here so that it can be inlined into its callers.
  */
-double map(double x, double in_min,  double in_max, 
-                     double out_min, double out_max);
-
+MYCUTILS_INLINE double map(double x, double in_min,  double in_max, 
+                                     double out_min, double out_max)
+{
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
 
 /********************************* Time **************************************/
 
 /**
  * This function returns true if a number of nano-seconds equal to or greater
- * than wait_time has elapsed since start.
+ * than wait_time has elapsed since start. It is defined here so that it can
+ * be inlined into frame loops.
  */
-bool check_timer(struct timespec ts_start, uint64_t wait_time);
+MYCUTILS_INLINE bool check_timer(struct timespec start, uint64_t wait_time)
+{
+    const bool HAS_ELAPSED = true;      /* Value if time has elapsed. */
+    const bool NOT_ELAPSED = false;     /* Value if time has not elapsed. */
+    struct timespec current;            /* The current time. */
+    struct timespec elapsed;            /* The time elapsed since start. */
+
+    /* Obtaining the current time. */
+    clock_gettime(CLOCK_REALTIME, &current);
+
+    /* Calculating the elapsed time. */
+    elapsed.tv_sec = current.tv_sec - start.tv_sec;
+    elapsed.tv_nsec = current.tv_nsec - start.tv_nsec;
+
+#ifdef MYCUTILS_HAVE_PROBES
+    /* Firing the frame pacing probe with the elapsed and wanted times. */
+    DTRACE_PROBE2(mycutils, check_timer, 
+                  (int64_t) elapsed.tv_sec * NANOS_PER_SEC + elapsed.tv_nsec,
+                  wait_time);
+#endif
+
+    /* Checking whether the time hasn't elapsed. */
+    if ((uint64_t) (elapsed.tv_sec * NANOS_PER_SEC + elapsed.tv_nsec) 
+            < wait_time)
+        return NOT_ELAPSED;
+
+    /* The time has elapsed. */
+    return HAS_ELAPSED;
+}
 
 /**
  * This function obtains the current time, storing it in the timespec
  * provided to it.
  */
-void start_timer(struct timespec* ts);
+MYCUTILS_API void start_timer(struct timespec* ts);
 
 /**
  * This function returns a string that represent the current time.
  */
-char* timestamp();
+MYCUTILS_API char* timestamp();
 
 /******************************** In/Out *************************************/
 
@@ -69,19 +172,19 @@ char* timestamp();
  * This function prints a prompt to the user, then assigns a string that is
  * input by the user to the buffer provided to it.
  */
-void scans(char** buf, char* prompt);
+MYCUTILS_API void scans(char** buf, char* prompt);
 
 /**
  * This function returns a char that was input by the user. It doesn't wait
  * for the user to press enter. (Not my code)
  */
-char scanc_nowait();
+MYCUTILS_API char scanc_nowait();
 
 /**
  * Closes the provided file stream. If there is an error, it is printed on
  * stderr and the program will exit.
  */
-void closefs(FILE* fp);
+MYCUTILS_API void closefs(FILE* fp);
 
 /**
  * This function opens a file that has a name that matches fname. It opens the
@@ -90,13 +193,13 @@ void closefs(FILE* fp);
  * is exited. If the file is successfully opened, this function
  * will return a pointer to the file stream.
  */
-FILE* openfs(char* fname, char* mode);
+MYCUTILS_API FILE* openfs(char* fname, char* mode);
 
 /**
  * This function assigns the next char in the file stream provided to it to
  * the buffer provided to it.
  */
-bool readfsc(FILE* fstreamp, char* buf);
+MYCUTILS_API bool readfsc(FILE* fstreamp, char* buf);
 
 /**
  * This function assigns the next line in the file stream provided to it to
@@ -104,20 +207,692 @@ bool readfsc(FILE* fstreamp, char* buf);
  * or false if EOF was reached. If an error occurs the program will exit.
  * Make sure to free() the buffer when you're finished with it.
  */
-bool readfsl(FILE* fstreamp, char** buf);
+MYCUTILS_API bool readfsl(FILE* fstreamp, char** buf);
 
 /**
- * This function writes the char provided to it to the file stream provided to
- * it.
+ * This function writes the char provided to it to the file stream provided
+ * to it. It is defined here so that it can be inlined into its callers.
  */
-void writefsc(FILE* fstreamp, char ch);
+MYCUTILS_INLINE void writefsc(FILE* fs, char ch)
+{
+    /* Writing the char to the file stream. */
+    putc(ch, fs);
+}
 
 /**
  * This function writes the string provided to it to the file steam provided
  * to it.
  */
-void writefss(FILE* fstreamp, char* str);
+MYCUTILS_API void writefss(FILE* fstreamp, char* str);
+
+/**
+ * This function writes len chars of the string provided to it to the file
+ * stream provided to it.
+ */
+MYCUTILS_API void writefsn(FILE* fs, const char* str, size_t len);
+
+/**
+ * This is a file that is being written atomically. Write to it through fs
+ * with the usual functions, then commit it with closefs_atomic().
+ */
+typedef struct {
+    FILE* fs;       /* The stream of the temporary file. */
+    char* tmpname;  /* The name of the temporary file. */
+    char* fname;    /* The name of the file being replaced. */
+} atomicfs;
+
+/**
+ * This function begins replacing the file that has a name that matches fname.
+ * It opens a temporary file in the same directory for writing. The file
+ * named fname is not touched until closefs_atomic() is called. If fname is a
+ * symbolic link, the file it points to is replaced and the link is kept.
+ * If there is an error it will be printed on stderr and the program is
+ * exited.
+ */
+MYCUTILS_API atomicfs* openfs_atomic(char* fname);
+
+/**
+ * This function commits an atomic write. It flushes and syncs the temporary
+ * file, renames it over the file being replaced, then syncs the directory so
+ * the rename is durable. Threads committing at the same time share their
+ * directory syncs. If there is an error the temporary file is removed, the
+ * error is printed on stderr and the program is exited.
+ */
+MYCUTILS_API void closefs_atomic(atomicfs* afs);
+
+/**
+ * This is a follower of a growing file, like tail -F.
+ */
+typedef struct follower follower;
+
+/**
+ * This is called by follows() for each new line. The line is not
+ * null-terminated or newline-terminated and is only valid during the call.
+ */
+typedef void (*follow_cb)(const char* line, size_t len, void* arg);
+
+/**
+ * This function starts following the file that has a name that matches fname.
+ * If from_end is true only lines appended after this call are delivered.
+ * If there is an error it will be printed on stderr and the program is
+ * exited.
+ */
+MYCUTILS_API follower* openfollow(char* fname, bool from_end);
+
+/**
+ * This function returns a file descriptor that becomes readable when the
+ * followed file may have changed, so a follower can be added to an event
+ * loop. Call follows() with a timeout of 0 when it is readable.
+ */
+MYCUTILS_API int follow_fd(follower* f);
+
+/**
+ * This is how often, in milliseconds, a file that can't be watched is
+ * checked for changes.
+ */
+#ifndef FOLLOW_POLL_MS
+#define FOLLOW_POLL_MS 250
+#endif
+
+/**
+ * This function waits up to timeout milliseconds (-1 waits forever) for the
+ * followed file to change, then calls cb for each complete line appended
+ * since the last call. It follows the file across rotation and truncation.
+ * If the file can't be watched, for example because there are no inotify
+ * watches left, it is checked every FOLLOW_POLL_MS milliseconds instead.
+ * It returns the number of lines delivered.
+ */
+MYCUTILS_API size_t follows(follower* f, int timeout, follow_cb cb, void* arg);
+
+/**
+ * This function stops following a file and frees the follower.
+ */
+MYCUTILS_API void closefollow(follower* f);
+
+/**
+ * Files smaller than this are read with stdio.
+ */
+#ifndef READ_STDIO_MAX
+#define READ_STDIO_MAX (64 * 1024)
+#endif
+
+/**
+ * Files at least this big are mapped rather than read into a buffer.
+ */
+#ifndef READ_MMAP_MIN
+#define READ_MMAP_MIN (4 * 1024 * 1024)
+#endif
+
+/**
+ * Hot files up to this size are mapped with their pages prefaulted.
+ */
+#ifndef READ_POPULATE_MAX
+#define READ_POPULATE_MAX (8 * 1024 * 1024)
+#endif
+
+/**
+ * Mapped files read sequentially are read ahead this many bytes at a time,
+ * the next window being asked for once the reader is half way through the
+ * current one.
+ */
+#ifndef READ_AHEAD_SIZE
+#define READ_AHEAD_SIZE (16 * 1024 * 1024)
+#endif
+
+/**
+ * This is the size of the buffer used by READ_BUFFERED readers. It is one
+ * huge page by default.
+ */
+#ifndef READ_BUF_SIZE
+#define READ_BUF_SIZE (2 * 1024 * 1024)
+#endif
+
+enum readhints {
+    READ_SEQUENTIAL,    /* The file will be read once from start to end. */
+    READ_RANDOM,        /* The file will be read out of order. */
+    READ_HOT            /* The file will be read again soon and often. */
+    };
+
+enum readmodes {
+    READ_STDIO,         /* A stdio stream. */
+    READ_BUFFERED,      /* Large read() calls into a private buffer. */
+    READ_MMAP           /* A memory mapping of the whole file. */
+    };
+
+/**
+ * This is a file opened for reading lines with the strategy best suited to
+ * its size and how it will be used.
+ */
+typedef struct reader reader;
+
+/**
+ * This function opens the file that has a name that matches fname for
+ * reading. It chooses how the file will be read from the file's size and the
+ * hint provided to it, and advises the kernel of the access pattern.
+ * If there is an error it will be printed on stderr and the program is
+ * exited.
+ */
+MYCUTILS_API reader* openrd(char* fname, enum readhints hint);
+
+/**
+ * This function returns how the reader provided to it reads its file.
+ */
+MYCUTILS_API enum readmodes rdmode(reader* r);
+
+/**
+ * This function points line at the next line in the reader provided to it
+ * and stores its length, without the newline, in len. The line is not
+ * null-terminated and is only valid until the next call. It returns true if
+ * a line was read or false if EOF was reached. If an error occurs the program
+ * will exit.
+ */
+MYCUTILS_API bool readrdl(reader* r, const char** line, size_t* len);
+
+/**
+ * This function closes the reader provided to it.
+ */
+MYCUTILS_API void closerd(reader* r);
+
+/**
+ * This is the size of each of a direct writer's two staging blocks. It must
+ * be a multiple of DIRECT_ALIGN.
+ */
+#ifndef DIRECT_BLOCK_SIZE
+#define DIRECT_BLOCK_SIZE (4 * 1024 * 1024)
+#endif
+
+/**
+ * This is the alignment O_DIRECT requires of buffers, offsets and lengths.
+ */
+#define DIRECT_ALIGN 4096
+
+/**
+ * This is a writer that bypasses the page cache, for large sequential
+ * outputs that shouldn't evict other programs' cached data.
+ */
+typedef struct dwriter dwriter;
+
+/**
+ * This function creates or truncates the file that has a name that matches
+ * fname and opens it for direct writing. Data is staged in aligned blocks
+ * that are written by a background thread while the next block fills. If
+ * the filesystem doesn't support O_DIRECT, the written ranges are dropped
+ * from the page cache instead. If there is an error it will be printed on
+ * stderr and the program is exited.
+ */
+MYCUTILS_API dwriter* opendw(char* fname);
+
+/**
+ * This function writes len bytes of data to the direct writer provided to it.
+ */
+MYCUTILS_API void writedw(dwriter* w, const char* data, size_t len);
+
+/**
+ * This function writes the string provided to it to the direct writer
+ * provided to it.
+ */
+MYCUTILS_API void writedws(dwriter* w, char* str);
+
+/**
+ * This function writes any staged data, including a final block that isn't
+ * a whole multiple of DIRECT_ALIGN, then closes the direct writer.
+ */
+MYCUTILS_API void closedw(dwriter* w);
+
+/**
+ * This function replaces the file named dst with a copy of the file named
+ * src. The kernel moves the data without it passing through this program,
+ * sharing the source's blocks when the filesystem supports reflinks. It
+ * returns the number of bytes copied. If there is an error, including src
+ * and dst being the same file, it will be printed on stderr and the
+ * program is exited.
+ */
+MYCUTILS_API off_t copyfs(char* src, char* dst);
+
+/**
+ * This function appends the file named src to the file named dst, creating
+ * dst if it doesn't exist. It returns the number of bytes appended. If there
+ * is an error, including src and dst being the same file, it will be
+ * printed on stderr and the program is exited.
+ */
+MYCUTILS_API off_t appendfs(char* src, char* dst);
+
+/**
+ * This function replaces the file named dst with the n files named in srcs
+ * joined end to end. It returns the number of bytes written. If there is an
+ * error, including dst being one of the sources, it will be printed on
+ * stderr and the program is exited.
+ */
+MYCUTILS_API off_t concatfs(char** srcs, size_t n, char* dst);
+
+/**
+ * This is the size of a byte stream's buffer.
+ */
+#ifndef BSTREAM_BUF_SIZE
+#define BSTREAM_BUF_SIZE (64 * 1024)
+#endif
+
+/**
+ * This is a byte stream for character-level parsing. Unlike readfsc() it
+ * takes no locks and its operations are inlined, so each byte costs a
+ * compare and a load. One byte can always be unread after bsnext().
+ */
+typedef struct {
+    int fd;                 /* The file's descriptor. */
+    char* fname;            /* The name of the file. */
+    unsigned char* buf;     /* The buffer, with one byte of put-back room. */
+    unsigned char* pos;     /* The next unread byte. */
+    unsigned char* end;     /* The end of the buffered bytes. */
+} bstream;
+
+/**
+ * This function opens the file that has a name that matches fname as a
+ * byte stream. If there is an error it will be printed on stderr and the
+ * program is exited.
+ */
+MYCUTILS_API bstream* openbs(char* fname);
+
+/**
+ * This function refills an empty byte stream's buffer, keeping the last byte
+ * read so it can still be unread. It returns false if EOF was reached. If an
+ * error occurs the program will exit.
+ */
+MYCUTILS_API bool bsfill(bstream* bs);
+
+/**
+ * This function closes the byte stream provided to it.
+ */
+MYCUTILS_API void closebs(bstream* bs);
+
+/**
+ * This function returns the next byte in the byte stream, or EOF.
+ */
+static inline int bsnext(bstream* bs)
+{
+    if (bs->pos == bs->end && !bsfill(bs))
+        return EOF;
+    return *bs->pos++;
+}
+
+/**
+ * This function returns the next byte in the byte stream, or EOF, without
+ * consuming it.
+ */
+static inline int bspeek(bstream* bs)
+{
+    if (bs->pos == bs->end && !bsfill(bs))
+        return EOF;
+    return *bs->pos;
+}
+
+/**
+ * This function puts back the byte most recently returned by bsnext().
+ */
+static inline void bsunread(bstream* bs)
+{
+    bs->pos--;
+}
+
+/**
+ * This function consumes bytes for as long as pred returns true for them.
+ * It returns the number of bytes skipped.
+ */
+static inline size_t bsskip(bstream* bs, int (*pred)(int))
+{
+    size_t skipped;     /* The number of bytes skipped. */
+
+    skipped = 0;
+    for (;;)
+    {
+        /* Scanning the buffered bytes. */
+        while (bs->pos < bs->end && pred(*bs->pos))
+        {
+            bs->pos++;
+            skipped++;
+        }
+
+        /* Stopping at a byte that doesn't match or at EOF. */
+        if (bs->pos < bs->end || !bsfill(bs))
+            return skipped;
+    }
+}
+
+/**
+ * This function points span at the buffered bytes that haven't been read,
+ * refilling the buffer if it is empty, and returns how many there are. It
+ * returns 0 at EOF. Use bsadvance() to consume bytes scanned in bulk.
+ */
+static inline size_t bsspan(bstream* bs, const char** span)
+{
+    if (bs->pos == bs->end && !bsfill(bs))
+        return 0;
+    *span = (const char*) bs->pos;
+    return bs->end - bs->pos;
+}
+
+/**
+ * This function consumes n bytes of the span returned by bsspan().
+ */
+static inline void bsadvance(bstream* bs, size_t n)
+{
+    bs->pos += n;
+}
+
+/******************************** Memory *************************************/
+
+/**
+ * This is the size of a huge page. Large buffers of at least this size are
+ * backed by huge pages so that fewer TLB entries cover them.
+ */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * Defining this as 0 backs large buffers with normal pages only.
+ */
+#ifndef BIG_HUGE_PAGES
+#define BIG_HUGE_PAGES 1
+#endif
+
+/**
+ * This function maps size bytes of memory for a large buffer. Buffers of at
+ * least HUGE_PAGE_SIZE are backed by huge pages from the hugetlb pool if any
+ * are free, or else aligned and advised for transparent huge pages. If
+ * prefault is true every page is faulted in before the function returns.
+ * It returns NULL if size is 0. The memory must be freed with big_free().
+ * If there is an error it will be printed on stderr and the program is
+ * exited.
+ */
+MYCUTILS_API void* big_alloc(size_t size, bool prefault);
+
+/**
+ * This function moves the large buffer provided to it, which holds old
+ * bytes, into a new one of size bytes and returns the new buffer.
+ */
+MYCUTILS_API void* big_realloc(void* mem, size_t old, size_t size);
+
+/**
+ * This function frees the large buffer of the size provided. Freeing NULL
+ * does nothing.
+ */
+MYCUTILS_API void big_free(void* mem, size_t size);
+
+/**
+ * This function returns the size of the pages backing the most recently
+ * allocated large buffer. It is HUGE_PAGE_SIZE if huge pages were used and
+ * the normal page size otherwise.
+ */
+MYCUTILS_API size_t big_page_size();
+
+/******************************** Threads ************************************/
+
+/**
+ * This is the most NUMA nodes a pool spreads its workers over.
+ */
+#define POOL_MAX_NODES 64
+
+/**
+ * This is a task run by a thread pool.
+ */
+typedef void (*pool_fn)(void* arg);
+
+/**
+ * This counts the unfinished tasks of a group, so that whoever submitted
+ * them can wait for just those. It must start at zero.
+ */
+typedef struct {
+    size_t pending;     /* The number of unfinished tasks. */
+} taskgroup;
+
+/**
+ * This is a pool of worker threads spread over the machine's NUMA nodes.
+ */
+typedef struct pool pool;
+
+/**
+ * This function creates a pool of nthreads worker threads, or one per CPU
+ * the process may use if nthreads is 0. The NUMA topology is read from
+ * sysfs and the workers are shared between the nodes by their number of
+ * CPUs. Each worker is pinned to its node's CPUs and takes tasks from its
+ * node's queue, only taking them from other nodes, nearest first, when its
+ * own queue is empty.
+ */
+MYCUTILS_API pool* new_pool(unsigned nthreads);
+
+/**
+ * This function returns the pool used by the library's parallel functions,
+ * creating it the first time. It has one worker per CPU and is never freed.
+ */
+MYCUTILS_API pool* shared_pool();
+
+/**
+ * This function returns the number of NUMA nodes the pool provided to it
+ * has workers on. Nodes are numbered from 0 up to this.
+ */
+MYCUTILS_API int pool_nodes(pool* p);
+
+/**
+ * This function adds a task that calls fn with arg to the queue of the node
+ * provided, or spreads it over the nodes if node is -1. If g isn't NULL the
+ * task is counted in it.
+ */
+MYCUTILS_API void pool_submit(pool* p, taskgroup* g, int node, pool_fn fn,
+                              void* arg);
+
+/**
+ * This function adds a task like pool_submit(), on the node whose memory
+ * holds the page at addr, so a task working on part of a large buffer or
+ * mapped file runs next to it.
+ */
+MYCUTILS_API void pool_submit_at(pool* p, taskgroup* g, const void* addr,
+                                 pool_fn fn, void* arg);
+
+/**
+ * This function returns once every task in the group provided to it has
+ * finished. While waiting, the calling thread runs tasks queued on its own
+ * node.
+ */
+MYCUTILS_API void pool_wait(pool* p, taskgroup* g);
+
+/**
+ * This function runs any tasks left in the pool provided to it, then stops
+ * its workers and frees it.
+ */
+MYCUTILS_API void free_pool(pool* p);
+
+/**
+ * This function maps size bytes of memory on the node of the pool provided,
+ * using huge pages for large sizes as big_alloc() does. The memory is bound
+ * to the node with mbind() and prefaulted, or if that isn't possible, its
+ * pages are touched from the node's CPUs so the kernel places them there.
+ * It returns NULL if the memory can't be mapped.
+ */
+MYCUTILS_API void* node_alloc(pool* p, int node, size_t size);
+
+/**
+ * This function frees memory from node_alloc() of the size provided.
+ */
+MYCUTILS_API void node_free(void* mem, size_t size);
+
+/********************************** CSV **************************************/
+
+/**
+ * This is one field of a CSV/TSV row. It points into the parsed data and
+ * is only valid during the row callback. A quoted field has its outer quotes
+ * removed but any escaped quotes inside it are left doubled.
+ */
+typedef struct {
+    const char* ptr;    /* The first byte of the field. */
+    size_t len;         /* The length of the field. */
+    bool quoted;        /* Whether the field was quoted. */
+} csvfield;
+
+/**
+ * This is called once for each row that is parsed. When parsing with more
+ * than one thread it is called from several threads at once, with each
+ * thread's rows in file order.
+ */
+typedef void (*csv_cb)(const csvfield* fields, size_t n, void* arg);
+
+/**
+ * This function parses len bytes of CSV (or TSV, or any single-byte
+ * delimiter) data and calls cb for each non-empty row. It finds delimiters,
+ * quotes and newlines 64 bytes at a time with bitmasks, so no per-field
+ * work or allocation is done. The data is split into nthreads chunks, or
+ * one per CPU if nthreads is 0, which are parsed by the shared pool, each
+ * on the NUMA node holding it. It returns the number of rows parsed.
+ */
+MYCUTILS_API size_t parsecsv(const char* data, size_t len, char delim,
+                             unsigned nthreads, csv_cb cb, void* arg);
+
+/**
+ * This function maps the file that has a name that matches fname and parses
+ * it with parsecsv(). If there is an error it will be printed on stderr and
+ * the program is exited.
+ */
+MYCUTILS_API size_t parsecsv_fs(char* fname, char delim, unsigned nthreads,
+                                csv_cb cb, void* arg);
+
+/****************************** JSON Lines ***********************************/
+
+/**
+ * This is the size of a JSON Lines writer's buffer.
+ */
+#ifndef JSONW_BUF_SIZE
+#define JSONW_BUF_SIZE (64 * 1024)
+#endif
+
+/**
+ * This is a writer of JSON Lines records. Each record is one JSON object on
+ * its own line, built with jwbegin(), one call per field, then jwend().
+ */
+typedef struct jsonw jsonw;
+
+/**
+ * This function creates a JSON Lines writer that writes to the file stream
+ * provided to it.
+ */
+MYCUTILS_API jsonw* openjw(FILE* fs);
+
+/**
+ * This function starts a record.
+ */
+MYCUTILS_API void jwbegin(jsonw* w);
+
+/**
+ * This function adds a string field of len bytes to the current record,
+ * escaping it as JSON requires.
+ */
+MYCUTILS_API void jwstr(jsonw* w, char* key, const char* val, size_t len);
+
+/**
+ * This function adds a null-terminated string field to the current record.
+ */
+MYCUTILS_API void jwcstr(jsonw* w, char* key, char* val);
 
+/**
+ * This function adds a signed integer field to the current record.
+ */
+MYCUTILS_API void jwint(jsonw* w, char* key, int64_t val);
+
+/**
+ * This function adds an unsigned integer field to the current record.
+ */
+MYCUTILS_API void jwuint(jsonw* w, char* key, uint64_t val);
+
+/**
+ * This function adds a floating point field to the current record, with the
+ * fewest digits that read back exactly and always with '.' as the decimal
+ * point. NaNs and infinities are written as null.
+ */
+MYCUTILS_API void jwdouble(jsonw* w, char* key, double val);
+
+/**
+ * This function adds a boolean field to the current record.
+ */
+MYCUTILS_API void jwbool(jsonw* w, char* key, bool val);
+
+/**
+ * This function adds a null field to the current record.
+ */
+MYCUTILS_API void jwnull(jsonw* w, char* key);
+
+/**
+ * This function ends the current record.
+ */
+MYCUTILS_API void jwend(jsonw* w);
+
+/**
+ * This function writes out anything buffered by the JSON Lines writer.
+ */
+MYCUTILS_API void flushjw(jsonw* w);
+
+/**
+ * This function flushes and frees the JSON Lines writer. The file stream is
+ * left open.
+ */
+MYCUTILS_API void closejw(jsonw* w);
+
+/******************************** Sorting ************************************/
+
+/**
+ * This is the most runs sortfs() merges at once. More runs than this are
+ * merged in several passes so the number of open files stays bounded.
+ */
+#ifndef SORT_MERGE_WAYS
+#define SORT_MERGE_WAYS 64
+#endif
+
+/**
+ * This is called by sortfs() to find the part of a line to sort by. It
+ * points key at the key and stores its length in keylen.
+ */
+typedef void (*sortkey_cb)(const char* line, size_t len, 
+                           const char** key, size_t* keylen);
+
+/**
+ * This function sorts the lines of the file named src into the file named
+ * dst, which may be larger than memory. Lines are sorted by the bytes of
+ * the key that the key callback finds, or by the whole line if key is NULL.
+ * The file is split into runs that fit budget bytes of sorting memory,
+ * which are radix sorted by nthreads threads (one per CPU if 0) and spilled
+ * to temporary files next to dst, then merged, at most SORT_MERGE_WAYS at
+ * a time. Every output line ends with a newline. It returns the number of
+ * lines sorted. If there is an error it will be printed on stderr and the
+ * program is exited.
+ */
+MYCUTILS_API size_t sortfs(char* src, char* dst, size_t budget,
+                           unsigned nthreads, sortkey_cb key);
+
+/********************************** CPU **************************************/
+
+/**
+ * These are the levels of vector instructions that the library's kernels
+ * are written for.
+ */
+enum cpulevels {
+    CPU_SCALAR,
+    CPU_SSE2,
+    CPU_SSSE3,
+    CPU_AVX2,
+    CPU_AVX512
+};
+
+/**
+ * This function returns the highest level of vector instructions that both
+ * the CPU and the operating system support. It is found once, with cpuid
+ * and xgetbv, and the kernels for it are chosen at the same time. Setting
+ * the environment variable MYCUTILS_CPU to scalar, sse2, ssse3, avx2 or
+ * avx512 lowers the level, so slower kernels can be measured and tested.
+ * It applies to every kernel chosen at run time: those of the encoding,
+ * CSV, JSON, string and terminal code.
+ */
+MYCUTILS_API enum cpulevels cpu_level();
+
+/**
+ * This function returns the name of the level provided to it, as used by
+ * MYCUTILS_CPU.
+ */
+MYCUTILS_API const char* cpu_level_name(enum cpulevels level);
 
 /******************************** Strings ************************************/
 
@@ -126,26 +901,84 @@ void writefss(FILE* fstreamp, char* str);
  * allocated based on the variable argument list and a format string that are
  * provided to this function.
  */
-size_t vbytesfmt(va_list lp, char* fmt);
+MYCUTILS_API size_t vbytesfmt(va_list lp, char* fmt);
 
 /**
  * This function dynamically allocates only the needed amount of memory to a
  * string based on the argument list, then concatenates the argument list into 
  * the supplied format and stores it in the supplied string pointer.
  */
-void strfmt(char** sp, char *fmt, ...);
+MYCUTILS_API void strfmt(char** sp, char *fmt, ...);
 
 /**
  * This function removes the char element from the string provided to it which
  * is at the element number provided to it.
  */
-void sdelelem(char** sp, unsigned elem);
+MYCUTILS_API void sdelelem(char** sp, unsigned elem);
 
 /**
  * This function removes all cases of the provided char from the string at the
  * provided pointer.
  */
-void sdelchar(char** sp, char remove);
+MYCUTILS_API void sdelchar(char** sp, char remove);
+
+/**
+ * This function joins the n strings in parts, with the separator provided
+ * between each pair, into a string it allocates to the supplied string
+ * pointer. The result is allocated once, at its exact size.
+ */
+MYCUTILS_API void sjoin(char** sp, char** parts, size_t n, char* sep);
+
+/**
+ * This function copies the string str into a string it allocates to the
+ * supplied string pointer, with every occurrence of needle replaced by
+ * replacement. The result is allocated once, at its exact size. It returns
+ * the number of occurrences replaced.
+ */
+MYCUTILS_API size_t sreplall(char** sp, char* str, char* needle,
+                             char* replacement);
+
+enum charclasses {
+    CLASS_UPPER,        /* A to Z. */
+    CLASS_LOWER,        /* a to z. */
+    CLASS_DIGIT,        /* 0 to 9. */
+    CLASS_SPACE,        /* Space, \t, \n, \v, \f and \r. */
+    CLASS_CONTROL,      /* Bytes below 0x20, and 0x7F. */
+    CLASS_NONASCII      /* Bytes of 0x80 and above, such as UTF-8. */
+    };
+
+/**
+ * This function writes len bytes from in to out with the ASCII letters in
+ * upper case. Other bytes, including UTF-8, are copied as they are. out may
+ * be the same as in. Neither needs a null character.
+ */
+MYCUTILS_API void supper(char* out, const char* in, size_t len);
+
+/**
+ * This function writes len bytes from in to out with the ASCII letters in
+ * lower case. Other bytes, including UTF-8, are copied as they are. out may
+ * be the same as in. Neither needs a null character.
+ */
+MYCUTILS_API void slower(char* out, const char* in, size_t len);
+
+/**
+ * This function finds the part of the len bytes at in without leading and
+ * trailing ASCII whitespace. It points start at it and returns its length.
+ */
+MYCUTILS_API size_t strim(const char* in, size_t len, const char** start);
+
+/**
+ * This function writes len bytes from in to out with each control
+ * character replaced by the char provided. out may be the same as in. It
+ * returns the number of bytes replaced.
+ */
+MYCUTILS_API size_t sreplctrl(char* out, const char* in, size_t len, char with);
+
+/**
+ * This function returns the number of the len bytes at in that are in the
+ * class of characters provided.
+ */
+MYCUTILS_API size_t scount(const char* in, size_t len, enum charclasses cls);
 
 /**
  * This function removes the last character before the null character
@@ -153,6 +986,120 @@ void sdelchar(char** sp, char remove);
  */
 //void stringrmlast(char** s);
 
+/******************************* Encoding ************************************/
+
+/**
+ * This is the number of chars hexenc() writes for n bytes.
+ */
+#define HEXENC_LEN(n) ((n) * 2)
+
+/**
+ * This is the number of chars b64enc() writes for n bytes. URL-safe output
+ * is not padded so it may be shorter.
+ */
+#define B64ENC_LEN(n) (((n) + 2) / 3 * 4)
+
+/**
+ * This is the most bytes b64dec() writes for n chars.
+ */
+#define B64DEC_LEN(n) ((n) / 4 * 3 + 2)
+
+enum b64alphabets {
+    B64_STD,    /* The standard alphabet, padded with '='. */
+    B64_URL     /* The URL and file name safe alphabet, unpadded. */
+    };
+
+/**
+ * This function writes len bytes from in as lowercase hex to out, which must
+ * have room for HEXENC_LEN(len) chars. No null character is written. It
+ * returns the number of chars written. The fastest of the AVX-512, AVX2,
+ * SSSE3 and plain versions allowed by cpu_level() is used.
+ */
+MYCUTILS_API size_t hexenc(char* out, const void* in, size_t len);
+
+/**
+ * This function writes the bytes encoded by len chars of hex from in, in
+ * either case, to out, which must have room for len / 2 bytes. It returns
+ * the number of bytes written, or (size_t) -1 if the input isn't valid hex.
+ */
+MYCUTILS_API size_t hexdec(void* out, const char* in, size_t len);
+
+/**
+ * This function writes len bytes from in as base64 in the alphabet provided
+ * to out, which must have room for B64ENC_LEN(len) chars. No null character
+ * is written. It returns the number of chars written.
+ */
+MYCUTILS_API size_t b64enc(char* out, const void* in, size_t len,
+                           enum b64alphabets alpha);
+
+/**
+ * This function writes the bytes encoded by len chars of base64 in the
+ * alphabet provided to out, which must have room for B64DEC_LEN(len) bytes.
+ * Padding is optional. It returns the number of bytes written, or
+ * (size_t) -1 if the input isn't valid base64.
+ */
+MYCUTILS_API size_t b64dec(void* out, const char* in, size_t len,
+                           enum b64alphabets alpha);
+
+/**************************** Flight recorder ********************************/
+
+/**
+ * This is the number of events each thread's flight recorder remembers. It
+ * must be a power of two.
+ */
+#define FLIGHT_EVENTS 256
+
+/**
+ * This is the longest path that the flight recorder can dump to.
+ */
+#define FLIGHT_PATH_MAX 256
+
+enum flight_ops {
+    FLIGHT_OPENFS,
+    FLIGHT_CLOSEFS,
+    FLIGHT_READFSC,
+    FLIGHT_READFSL,
+    FLIGHT_WRITEFSS,
+    FLIGHT_START_TIMER
+    };
+
+/**
+ * This is one event in the flight recorder. A negative size records the
+ * errno of a failed operation.
+ */
+typedef struct {
+    uint64_t ns;    /* Monotonic time of the event in nanoseconds. */
+    uint32_t op;    /* The operation, one of enum flight_ops. */
+    int32_t fd;     /* The file descriptor involved, or -1. */
+    int64_t size;   /* The number of bytes involved, or -errno. */
+} flight_event;
+
+/**
+ * This function records an event in the calling thread's flight recorder.
+ */
+MYCUTILS_API void flight_record(enum flight_ops op, int fd, int64_t size);
+
+/**
+ * This function writes the calling thread's recent events, oldest first, to
+ * the flight recorder's dump file. Nothing is written unless a dump file
+ * has been set by flight_set_path() or the MYCUTILS_FLIGHT environment
+ * variable. Once flight_catch_signals() has been called it only uses
+ * async-signal-safe calls, so it may be called from a signal handler.
+ */
+MYCUTILS_API void flight_dump();
+
+/**
+ * This function sets the path of the file the flight recorder dumps to,
+ * which turns dumping on. An empty path turns it off again.
+ */
+MYCUTILS_API void flight_set_path(char* path);
+
+/**
+ * This function installs signal handlers that dump the flight recorder when
+ * the program receives a fatal signal.
+ */
+MYCUTILS_API void flight_catch_signals();
+
 /******************************* Terminal ************************************/
 
 #define LINE_HEIGHT 8
@@ -184,82 +1131,258 @@ enum textmodes {
     UNDERLINE
     };
 
+enum alignments {
+    ALIGN_LEFT,
+    ALIGN_CENTRE,
+    ALIGN_RIGHT
+    };
+
+enum wrapmodes {
+    WRAP_GREEDY,        /* Fill each line as far as it will go. */
+    WRAP_OPTIMAL        /* Balance the lines to minimise ragged edges. */
+    };
+
+/**
+ * This is the number of columns between tab stops.
+ */
+#define TAB_WIDTH 8
+
+/**
+ * This is the number of wrapped strings whose line breaks are remembered by
+ * each thread.
+ */
+#define LAYOUT_CACHE_SIZE 1024
+
 /**
  * This function clears the terminal.
  */
-void clear();
+MYCUTILS_API void clear();
 
 /**
  * This function clears the current line the terminal cursor is on from
  * the position of the cursor to the line's beginning.
  */
-void clearb();
+MYCUTILS_API void clearb();
 
 /**
  * This function clears the current line the terminal cursor is on from
  * the position of the cursor to the line's end.
  */
-void clearf();
+MYCUTILS_API void clearf();
 
 /**
  * This function clears the entire line that the terminal cursor is currently
  * on.
  */
-void clearfb();
+MYCUTILS_API void clearfb();
 
 /**
- * This function returns the number of rows and columns of the terminal.
+ * This function returns the number of rows and columns of the terminal. If
+ * standard output isn't a terminal, the size in its terminfo entry is used,
+ * or 0 if it has none.
  */
-vec2d get_res();
+MYCUTILS_API vec2d get_res();
 
 /**
  * This function moves the terminal cursor a number of rows or columns
  * equal to the number provided to the function, and in a direction that is
  * also provided.
  */
-void move_cursor(enum directions direction, unsigned int n);
+MYCUTILS_API void move_cursor(enum directions direction, unsigned int n);
 
 /**
  * This function prints the text file at the file path provided to it. It
  * prints the text file in the colours and mode that are provided to
  * the function.
  */
-void print_fs_mod(char* filepath, vec2d origin, enum termcolours colour, 
-                                                enum textmodes mode);
+MYCUTILS_API void print_fs_mod(char* filepath, vec2d origin,
+                               enum termcolours colour, enum textmodes mode);
 
 /**
  * This function prints the string provided to it at the position that is
- * also provided to the function.
+ * also provided to the function. The string is printed exactly as it is,
+ * except that control characters, which could change the terminal's state,
+ * are shown in caret notation such as ^[.
  */
-void print_str(char* str, vec2d pos);
+MYCUTILS_API void print_str(char* str, vec2d pos);
+
+/**
+ * This function prints len chars of the string provided to it at the
+ * position that is also provided to the function, in the same way as
+ * print_str().
+ */
+MYCUTILS_API void print_strn(const char* str, size_t len, vec2d pos);
+
+/**
+ * This function writes out anything in the calling thread's terminal output
+ * buffer. Each thread gathers its output, and keeps its cache of wrapped
+ * strings, on its own rather than behind a lock, so threads may print at
+ * the same time and their output is only interleaved between flushes.
+ */
+MYCUTILS_API void term_flush();
 
 /**
  * This function prints the string provided to it at the location
  * that is also provided. It prints the string in the colours and in the
  * mode provided.
  */
-void print_str_mod(char* str, vec2d origin, enum termcolours fcol,
-                                            enum textmodes mode);
+MYCUTILS_API void print_str_mod(char* str, vec2d origin, enum termcolours fcol,
+                                enum textmodes mode);
+
+/**
+ * This function prints the string provided to it wrapped to width columns,
+ * with its first line at the position provided. Tabs are expanded, lines
+ * are aligned as asked, and if maxlines is not 0 and the string needs more
+ * lines, the last line printed ends with "...". Line breaks are remembered
+ * by the string's contents and width, so printing the same string again
+ * costs no layout work. It returns the number of lines printed.
+ */
+MYCUTILS_API int print_wrapped(char* str, vec2d pos, int width, int maxlines,
+                               enum alignments align, enum wrapmodes mode);
+
+/**
+ * This function returns the number of lines the string provided to it
+ * needs when wrapped to width columns.
+ */
+MYCUTILS_API int wrapped_lines(char* str, int width, enum wrapmodes mode);
+
+enum canvasmodes {
+    CANVAS_BRAILLE,     /* 2x4 pixels per cell in one colour. */
+    CANVAS_HALFBLOCK    /* 1x2 pixels per cell, each in its own colour. */
+    };
+
+/**
+ * This is a canvas of pixels smaller than a terminal cell, for plotting.
+ */
+typedef struct canvas canvas;
+
+/**
+ * This function creates a blank canvas that covers cols columns and rows rows
+ * of the terminal.
+ */
+MYCUTILS_API canvas* new_canvas(int cols, int rows, enum canvasmodes mode);
+
+/**
+ * This function returns the size of the canvas provided to it in pixels.
+ */
+MYCUTILS_API vec2d canvas_res(canvas* cv);
+
+/**
+ * This function clears every pixel of the canvas provided to it.
+ */
+MYCUTILS_API void canvas_clear(canvas* cv);
+
+/**
+ * This function sets the pixel at x, y of the canvas provided to it to the
+ * colour provided. Pixels off the canvas are ignored.
+ */
+MYCUTILS_API void canvas_set(canvas* cv, int x, int y, enum termcolours c);
+
+/**
+ * This function draws a line between two pixels of the canvas provided to
+ * it.
+ */
+MYCUTILS_API void canvas_line(canvas* cv, int x0, int y0, int x1, int y1,
+                              enum termcolours c);
+
+/**
+ * This function plots n points, whose coordinates are in xs and ys, on the
+ * canvas provided to it. The ranges provided are mapped onto the whole
+ * canvas, with y increasing upwards, and points outside them are left out.
+ * A range with no width is centred on the canvas. If joined is true, lines
+ * are drawn between consecutive points.
+ */
+MYCUTILS_API void canvas_plot(canvas* cv, const double* xs, const double* ys,
+                              size_t n, double xmin, double xmax, double ymin,
+                              double ymax, enum termcolours c, bool joined);
+
+/**
+ * This function prints the canvas provided to it with its top left cell at
+ * the position provided.
+ */
+MYCUTILS_API void print_canvas(canvas* cv, vec2d pos);
+
+/**
+ * This function frees the canvas provided to it.
+ */
+MYCUTILS_API void free_canvas(canvas* cv);
+
+/**
+ * This is the number of rows sampled to size a table's columns.
+ */
+#define TABLE_SAMPLE_ROWS 64
+
+/**
+ * This is the widest a table column is made.
+ */
+#define TABLE_MAX_WIDTH 40
+
+/**
+ * This is called by a table for the text of the cell at the row and column
+ * provided. The text only has to stay valid until the next call.
+ */
+typedef const char* (*table_cb)(size_t row, size_t col, void* arg);
+
+/**
+ * This is a table that only asks for the rows it is showing, so it can show
+ * any number of rows.
+ */
+typedef struct table table;
+
+/**
+ * This function creates a table of nrows rows and ncols columns, headed by
+ * the strings in headers, whose cells are provided by the callback cell.
+ * Column widths are worked out once from the headers and a sample of the
+ * rows.
+ */
+MYCUTILS_API table* new_table(size_t nrows, size_t ncols, char** headers,
+                              table_cb cell, void* arg);
+
+/**
+ * This function scrolls the table provided to it by the number of rows and
+ * columns provided, stopping at its edges.
+ */
+MYCUTILS_API void table_scroll(table* t, long rows, long cols);
+
+/**
+ * This function prints the rows and columns of the table provided to it that
+ * fit in an area of size columns and rows, at the position provided. The
+ * header stays at the top of the area.
+ */
+MYCUTILS_API void print_table(table* t, vec2d pos, vec2d size);
+
+/**
+ * This function frees the table provided to it.
+ */
+MYCUTILS_API void free_table(table* t);
 
 /**
  * This function places the terminal cursor at the row and column numbers
  * provided to it.
  */
-void put_cursor(unsigned int col, unsigned int row);
+MYCUTILS_API void put_cursor(unsigned int col, unsigned int row);
 
 /**
  * This function sets the background colour of the terminal cursor.
  */
-void text_bcol(enum termcolours c);
+MYCUTILS_API void text_bcol(enum termcolours c);
 
 /**
  * This function sets the foreground colour of the temrinal cursor.
  */
-void text_fcol(enum termcolours c);
+MYCUTILS_API void text_fcol(enum termcolours c);
 
 /**
  * This function changes the terminal text-mode.
  */
-void text_mode(enum textmodes m);
+MYCUTILS_API void text_mode(enum textmodes m);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif // MYCUTILS_H
+
+#if defined(MYCUTILS_IMPLEMENTATION) && !defined(MYCUTILS_C)
+#include "mycutils.c"
+#endif
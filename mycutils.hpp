@@ -0,0 +1,499 @@
+/**
+ * mycutils.hpp
+ *
+ * This file contains C++17 wrappers for the types and functions declared in
+ * mycutils.h. Each wrapper owns what the library hands back and releases it
+ * when it goes out of scope. It holds nothing but the C handle, so it costs
+ * no more than calling the C functions directly. It also has constexpr
+ * versions of map() and vec2d for arithmetic the compiler can do.
+ *
+ * Version: 1.0.2
+ * Author: Richard Gale
+ */
+
+#ifndef MYCUTILS_HPP
+#define MYCUTILS_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "mycutils.h"
+
+namespace mycutils {
+
+/********************************* Types *************************************/
+
+/**
+ * This is a vector of N numbers of type T. All of its operations are
+ * constexpr, so arithmetic on known values, such as LINE_HEIGHT and
+ * CHAR_WIDTH, is done by the compiler.
+ */
+template <typename T, std::size_t N>
+struct vec {
+    static_assert(std::is_arithmetic_v<T>, "vec needs an arithmetic type");
+    static_assert(N > 0, "vec needs at least one element");
+
+    T v[N];     /* The elements. */
+
+    constexpr vec() noexcept : v{} {}
+
+    template <typename... U,
+              typename = std::enable_if_t<sizeof...(U) == N>>
+    constexpr vec(U... u) noexcept : v{static_cast<T>(u)...} {}
+
+    constexpr vec(vec2d p) noexcept : v{static_cast<T>(p.x),
+                                        static_cast<T>(p.y)}
+    {
+        static_assert(N == 2, "only a vec of two elements is a vec2d");
+    }
+
+    constexpr operator vec2d() const noexcept
+    {
+        static_assert(N == 2, "only a vec of two elements is a vec2d");
+        return vec2d{static_cast<int>(v[0]), static_cast<int>(v[1])};
+    }
+
+    constexpr T& operator[](std::size_t i) noexcept { return v[i]; }
+    constexpr const T& operator[](std::size_t i) const noexcept
+    {
+        return v[i];
+    }
+
+    constexpr T& x() noexcept { return v[0]; }
+    constexpr T x() const noexcept { return v[0]; }
+    constexpr T& y() noexcept
+    {
+        static_assert(N > 1, "vec has no y element");
+        return v[1];
+    }
+    constexpr T y() const noexcept
+    {
+        static_assert(N > 1, "vec has no y element");
+        return v[1];
+    }
+
+    constexpr vec& operator+=(const vec& o) noexcept
+    {
+        for (std::size_t i = 0; i < N; i++)
+            v[i] += o.v[i];
+        return *this;
+    }
+    constexpr vec& operator-=(const vec& o) noexcept
+    {
+        for (std::size_t i = 0; i < N; i++)
+            v[i] -= o.v[i];
+        return *this;
+    }
+    constexpr vec& operator*=(const vec& o) noexcept
+    {
+        for (std::size_t i = 0; i < N; i++)
+            v[i] *= o.v[i];
+        return *this;
+    }
+    constexpr vec& operator*=(T s) noexcept
+    {
+        for (std::size_t i = 0; i < N; i++)
+            v[i] *= s;
+        return *this;
+    }
+    constexpr vec& operator/=(T s) noexcept
+    {
+        for (std::size_t i = 0; i < N; i++)
+            v[i] /= s;
+        return *this;
+    }
+
+    friend constexpr vec operator+(vec a, const vec& b) noexcept
+    {
+        return a += b;
+    }
+    friend constexpr vec operator-(vec a, const vec& b) noexcept
+    {
+        return a -= b;
+    }
+    friend constexpr vec operator*(vec a, const vec& b) noexcept
+    {
+        return a *= b;
+    }
+    friend constexpr vec operator*(vec a, T s) noexcept { return a *= s; }
+    friend constexpr vec operator*(T s, vec a) noexcept { return a *= s; }
+    friend constexpr vec operator/(vec a, T s) noexcept { return a /= s; }
+    friend constexpr vec operator-(vec a) noexcept { return a *= T(-1); }
+
+    friend constexpr bool operator==(const vec& a, const vec& b) noexcept
+    {
+        for (std::size_t i = 0; i < N; i++)
+            if (a.v[i] != b.v[i])
+                return false;
+        return true;
+    }
+    friend constexpr bool operator!=(const vec& a, const vec& b) noexcept
+    {
+        return !(a == b);
+    }
+};
+
+using vec2i = vec<int, 2>;
+using vec2f = vec<float, 2>;
+
+/******************************** Maths **************************************/
+
+/**
+ * This function maps value x to a value within a desired range. Integer
+ * types round towards zero, as integer division does.
+ */
+template <typename T>
+constexpr T map(T x, T in_min, T in_max, T out_min, T out_max) noexcept
+{
+    static_assert(std::is_arithmetic_v<T>, "map needs an arithmetic type");
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+/**
+ * This function maps value x from the range InMin to InMax to the range
+ * OutMin to OutMax, which are known at compile time. The ranges must be
+ * integers before C++20, though x can be floating point. The scale is
+ * worked out by the compiler, so floating point values cost one multiply
+ * and one add. Integer ranges that divide evenly cost one multiply or one
+ * division by a constant, which the compiler turns into a shift or a
+ * multiply.
+ */
+template <auto InMin, auto InMax, auto OutMin, auto OutMax, typename T>
+constexpr T map(T x) noexcept
+{
+    static_assert(std::is_arithmetic_v<T>, "map needs an arithmetic type");
+    static_assert(InMax != InMin, "map needs a non-empty input range");
+
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        constexpr T scale = (static_cast<T>(OutMax) - static_cast<T>(OutMin))
+                          / (static_cast<T>(InMax) - static_cast<T>(InMin));
+
+        return (x - static_cast<T>(InMin)) * scale + static_cast<T>(OutMin);
+    }
+    else
+    {
+        constexpr T in = static_cast<T>(InMax) - static_cast<T>(InMin);
+        constexpr T out = static_cast<T>(OutMax) - static_cast<T>(OutMin);
+
+        if constexpr (out % in == 0)
+            return (x - static_cast<T>(InMin)) * (out / in)
+                 + static_cast<T>(OutMin);
+        else if constexpr (out != 0 && in % out == 0)
+            return (x - static_cast<T>(InMin)) / (in / out)
+                 + static_cast<T>(OutMin);
+        else
+            return (x - static_cast<T>(InMin)) * out / in
+                 + static_cast<T>(OutMin);
+    }
+}
+
+/******************************** Strings ************************************/
+
+/**
+ * This is a string allocated by the library. It is freed when it goes out
+ * of scope.
+ */
+class string {
+public:
+    string() noexcept = default;
+    explicit string(char* p) noexcept : p_(p) {}
+    string(string&& other) noexcept : p_(std::exchange(other.p_, nullptr)) {}
+    string(const string&) = delete;
+    ~string() { std::free(p_); }
+
+    string& operator=(string&& other) noexcept
+    {
+        if (this != &other)
+        {
+            std::free(p_);
+            p_ = std::exchange(other.p_, nullptr);
+        }
+        return *this;
+    }
+    string& operator=(const string&) = delete;
+
+    /**
+     * This function frees the string and returns where a library function
+     * should put a new one, as in strfmt(s.out(), ...).
+     */
+    [[nodiscard]] char** out() noexcept
+    {
+        std::free(p_);
+        p_ = nullptr;
+        return &p_;
+    }
+
+    /**
+     * This function returns the string for library functions that change or
+     * reallocate it, such as readfsl() and sdelelem().
+     */
+    [[nodiscard]] char** inout() noexcept { return &p_; }
+
+    /**
+     * This function gives up ownership of the string, which must then be
+     * freed with free().
+     */
+    [[nodiscard]] char* release() noexcept
+    {
+        return std::exchange(p_, nullptr);
+    }
+
+    [[nodiscard]] char* get() const noexcept { return p_; }
+    [[nodiscard]] const char* c_str() const noexcept { return p_ ? p_ : ""; }
+    [[nodiscard]] std::string_view view() const noexcept
+    {
+        return p_ ? std::string_view(p_) : std::string_view();
+    }
+    operator std::string_view() const noexcept { return view(); }
+    explicit operator bool() const noexcept { return p_ != nullptr; }
+
+private:
+    char* p_ = nullptr;     /* The string. */
+};
+
+/**
+ * This function returns a string formatted like printf().
+ */
+template <typename... Args>
+[[nodiscard]] inline string format(const char* fmt, Args... args)
+{
+    string s;   /* The formatted string. */
+
+    strfmt(s.out(), const_cast<char*>(fmt), args...);
+    return s;
+}
+
+/**
+ * This function returns a string that represents the current time.
+ */
+[[nodiscard]] inline string make_timestamp()
+{
+    return string(::timestamp());
+}
+
+/**
+ * This function returns the string provided to it without its leading and
+ * trailing whitespace.
+ */
+[[nodiscard]] inline std::string_view trim(std::string_view s) noexcept
+{
+    const char* start;  /* The first char kept. */
+    size_t len;         /* The number of chars kept. */
+
+    len = strim(s.data(), s.size(), &start);
+    return std::string_view(start, len);
+}
+
+/**
+ * This function returns the number of chars of the class provided that are
+ * in the string provided.
+ */
+[[nodiscard]] inline size_t count(std::string_view s,
+                                  enum charclasses cls) noexcept
+{
+    return scount(s.data(), s.size(), cls);
+}
+
+/********************************* Time **************************************/
+
+/**
+ * This is a timer, started when it is made.
+ */
+class timer {
+public:
+    timer() { start_timer(&start_); }
+
+    /**
+     * This function starts the timer again.
+     */
+    void restart() { start_timer(&start_); }
+
+    /**
+     * This function returns true if at least wait_time nanoseconds have
+     * passed since the timer was started.
+     */
+    [[nodiscard]] bool elapsed(uint64_t wait_time) const noexcept
+    {
+        return check_timer(start_, wait_time);
+    }
+
+    [[nodiscard]] const struct timespec& start() const noexcept
+    {
+        return start_;
+    }
+
+private:
+    struct timespec start_;     /* When the timer was started. */
+};
+
+/******************************** In/Out *************************************/
+
+/**
+ * This is a file stream. It is closed when it goes out of scope.
+ */
+class file {
+public:
+    file() noexcept = default;
+    file(const char* fname, const char* mode)
+        : fs_(openfs(const_cast<char*>(fname), const_cast<char*>(mode))) {}
+    file(file&& other) noexcept : fs_(std::exchange(other.fs_, nullptr)) {}
+    file(const file&) = delete;
+    ~file() { close(); }
+
+    file& operator=(file&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            fs_ = std::exchange(other.fs_, nullptr);
+        }
+        return *this;
+    }
+    file& operator=(const file&) = delete;
+
+    /**
+     * This function reads the next char into c. It returns false at the end
+     * of the file.
+     */
+    [[nodiscard]] bool read(char& c) { return readfsc(fs_, &c); }
+
+    /**
+     * This function reads the next line into line, reusing its memory. It
+     * returns false at the end of the file.
+     */
+    [[nodiscard]] bool read_line(string& line)
+    {
+        return readfsl(fs_, line.inout());
+    }
+
+    void write(char c) { writefsc(fs_, c); }
+    void write(std::string_view s) { writefsn(fs_, s.data(), s.size()); }
+
+    /**
+     * This function closes the file stream early.
+     */
+    void close()
+    {
+        if (fs_)
+            closefs(std::exchange(fs_, nullptr));
+    }
+
+    [[nodiscard]] FILE* get() const noexcept { return fs_; }
+    explicit operator bool() const noexcept { return fs_ != nullptr; }
+
+private:
+    FILE* fs_ = nullptr;    /* The file stream. */
+};
+
+/**
+ * This is a reader of lines, made with openrd(). It is closed when it goes
+ * out of scope.
+ */
+class line_reader {
+public:
+    line_reader() noexcept = default;
+    explicit line_reader(const char* fname, 
+                         enum readhints hint = READ_SEQUENTIAL)
+        : r_(openrd(const_cast<char*>(fname), hint)) {}
+    line_reader(line_reader&& other) noexcept 
+        : r_(std::exchange(other.r_, nullptr)) {}
+    line_reader(const line_reader&) = delete;
+    ~line_reader() { close(); }
+
+    line_reader& operator=(line_reader&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            r_ = std::exchange(other.r_, nullptr);
+        }
+        return *this;
+    }
+    line_reader& operator=(const line_reader&) = delete;
+
+    /**
+     * This function points line at the next line, without its newline. The
+     * line is valid until the next call. It returns false at the end of the
+     * file.
+     */
+    [[nodiscard]] bool read_line(std::string_view& line)
+    {
+        const char* p;  /* The line. */
+        size_t len;     /* The length of the line. */
+
+        if (!readrdl(r_, &p, &len))
+            return false;
+        line = std::string_view(p, len);
+        return true;
+    }
+
+    [[nodiscard]] enum readmodes mode() const { return rdmode(r_); }
+
+    /**
+     * This function closes the reader early.
+     */
+    void close()
+    {
+        if (r_)
+            closerd(std::exchange(r_, nullptr));
+    }
+
+    [[nodiscard]] ::reader* get() const noexcept { return r_; }
+
+private:
+    ::reader* r_ = nullptr;     /* The reader. */
+};
+
+/******************************* Terminal ************************************/
+
+/**
+ * This is a session of drawing to the terminal. When it goes out of scope
+ * the text mode and colours are put back and any buffered output is
+ * written.
+ */
+class terminal {
+public:
+    terminal() noexcept = default;
+    terminal(terminal&& other) noexcept
+        : active_(std::exchange(other.active_, false)) {}
+    terminal(const terminal&) = delete;
+    ~terminal()
+    {
+        if (active_)
+        {
+            text_mode(NORMAL);
+            term_flush();
+        }
+    }
+
+    terminal& operator=(terminal&& other) noexcept
+    {
+        std::swap(active_, other.active_);
+        return *this;
+    }
+    terminal& operator=(const terminal&) = delete;
+
+    void clear() { ::clear(); }
+    void print(std::string_view s, vec2d pos)
+    {
+        print_strn(s.data(), s.size(), pos);
+    }
+    void move_to(unsigned int col, unsigned int row) { put_cursor(col, row); }
+    void colour(enum termcolours c) { text_fcol(c); }
+    void background(enum termcolours c) { text_bcol(c); }
+    void mode(enum textmodes m) { text_mode(m); }
+    void flush() { term_flush(); }
+
+    [[nodiscard]] vec2d size() const { return get_res(); }
+
+private:
+    bool active_ = true;    /* Whether this session puts the terminal back. */
+};
+
+} // namespace mycutils
+
+#endif // MYCUTILS_HPP
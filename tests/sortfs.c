@@ -0,0 +1,99 @@
+/**
+ * sortfs.c
+ *
+ * This file checks sortfs() against inputs with empty lines, blank last
+ * lines, no lines at all and more runs than are merged at once. Build it
+ * with: cc -pthread tests/sortfs.c mycutils.c -o sortfs_test
+ *
+ * Author: Richard Gale
+ */
+
+#include "../mycutils.h"
+
+/**
+ * This function writes the text provided to the file named fname.
+ */
+static void put(char* fname, const char* text)
+{
+    FILE* fs;   /* The file. */
+
+    fs = openfs(fname, "w");
+    writefss(fs, (char*) text);
+    closefs(fs);
+}
+
+/**
+ * This function returns the contents of the file named fname, which must be
+ * freed.
+ */
+static char* get(char* fname)
+{
+    FILE* fs;   /* The file. */
+    char* buf;  /* Its contents. */
+    long len;   /* Its length. */
+
+    fs = openfs(fname, "r");
+    fseek(fs, 0, SEEK_END);
+    len = ftell(fs);
+    rewind(fs);
+    buf = (char*) malloc(len + 1);
+    buf[fread(buf, 1, len, fs)] = '\0';
+    closefs(fs);
+    return buf;
+}
+
+/**
+ * This function sorts the input provided with the budget provided and
+ * returns true if the output matches the expected text.
+ */
+static bool check(const char* in, const char* want, size_t budget)
+{
+    char* got;  /* The sorted file. */
+    bool ok;    /* Whether it matched. */
+
+    put("sortfs_in.txt", in);
+    sortfs("sortfs_in.txt", "sortfs_out.txt", budget, 2, NULL);
+    got = get("sortfs_out.txt");
+    ok = strcmp(got, want) == 0;
+    if (!ok)
+        fprintf(stderr, "sorting \"%s\" with a budget of %zu gave \"%s\"\n", 
+                in, budget, got);
+    free(got);
+    return ok;
+}
+
+int main()
+{
+    char* in;       /* A large input. */
+    char* want;     /* Its lines sorted. */
+    size_t i;       /* Index of the current line. */
+    size_t len;     /* The length of the large input. */
+    bool ok;        /* Whether every check passed. */
+
+    ok = true;
+
+    /* Empty lines, including a blank last line in each run. */
+    ok &= check("b\na\n\n", "\na\nb\n", 1 << 20);
+    ok &= check("b\n\na\n\n\n", "\n\n\na\nb\n", 1 << 20);
+    ok &= check("b\n\na\n\n\n", "\n\n\na\nb\n", 1);
+    ok &= check("\n", "\n", 1);
+
+    /* No lines at all. */
+    ok &= check("", "", 1 << 20);
+
+    /* One run for every line, which is more than are merged at once. */
+    in = (char*) malloc(4 * 1000 + 1);
+    want = (char*) malloc(4 * 1000 + 1);
+    for (i = 0, len = 0; i < 1000; i++)
+        len += sprintf(in + len, "%03zu\n", (i * 7) % 1000);
+    for (i = 0, len = 0; i < 1000; i++)
+        len += sprintf(want + len, "%03zu\n", i);
+    ok &= check(in, want, 1);
+    free(in);
+    free(want);
+
+    remove("sortfs_in.txt");
+    remove("sortfs_out.txt");
+    printf("%s\n", ok ? "sortfs: ok" : "sortfs: FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}